@@ -0,0 +1,134 @@
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+
+#include "bvh.h"
+#include "common.h"
+#include "linear_bvh.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+#include "wide_bvh.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares BVH builders on the example meshes: build time, SAH cost of the resulting tree, and
+// closest-hit query throughput for random rays through the mesh bounds (single thread).
+// Meshes that aren't checked into the repo (bunny, dragon) are skipped if missing.
+// Then measures how SAH build time scales with thread count, for particle-like scenes of random spheres.
+
+std::vector<Ray> random_rays_through(const AABB &box, int num_rays)
+{
+  const Point3 center = box.centroid();
+  const double radius = (box.max() - box.min()).length();
+
+  std::vector<Ray> rays;
+  rays.reserve(num_rays);
+  for (int i = 0; i < num_rays; ++i)
+  {
+    const Point3 origin = center + radius * random_unit_vector();
+    const Point3 target = box.min() + Vec3::random() * (box.max() - box.min());
+    rays.emplace_back(origin, target - origin);
+  }
+  return rays;
+}
+
+double rays_per_second(const Hittable &bvh, const std::vector<Ray> &rays)
+{
+  auto start = std::chrono::steady_clock::now();
+  int num_hits = 0;
+  hit_record rec;
+  for (const auto &r : rays)
+    num_hits += bvh.hit(r, 0.001, infinity, &rec);
+  auto end = std::chrono::steady_clock::now();
+
+  if (num_hits < 0)
+    std::cerr << num_hits << std::endl;
+  return rays.size() / std::chrono::duration<double>(end - start).count();
+}
+
+void benchmark_builder(const std::string &label, HittableList triangles, const std::vector<Ray> &rays, const BVHBuildOptions &opts)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  BVHNode bvh(triangles, 0, 1, opts);
+  auto t1 = std::chrono::steady_clock::now();
+
+  auto t2 = std::chrono::steady_clock::now();
+  const LinearBVH linear_bvh(bvh);
+  auto t3 = std::chrono::steady_clock::now();
+
+  const double build_s = std::chrono::duration<double>(t1 - t0).count();
+  const double compile_s = std::chrono::duration<double>(t3 - t2).count();
+
+  std::cout << "  " << label
+            << " | build: " << build_s * 1e3 << " ms"
+            << " | compile: " << compile_s * 1e3 << " ms"
+            << " | SAH cost: " << bvh.sah_cost()
+            << " | tree: " << rays_per_second(bvh, rays) * 1e-6 << " Mrays/s"
+            << " | linear: " << rays_per_second(linear_bvh, rays) * 1e-6 << " Mrays/s"
+            << " | bvh4: " << rays_per_second(BVH4(bvh), rays) * 1e-6 << " Mrays/s"
+            << " | bvh8: " << rays_per_second(BVH8(bvh), rays) * 1e-6 << " Mrays/s" << std::endl;
+}
+
+void benchmark_build_scaling(int num_spheres)
+{
+  HittableList spheres;
+  for (int i = 0; i < num_spheres; ++i)
+    spheres.add(make_shared<Sphere>(Vec3::random(-100, 100), random_double(0.1, 1.0), nullptr));
+
+  std::cout << num_spheres << " spheres:";
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (int num_threads = 1;; num_threads = std::min(2 * num_threads, max_threads))
+  {
+    BVHBuildOptions opts;
+    opts.num_threads = num_threads;
+    auto t0 = std::chrono::steady_clock::now();
+    BVHNode bvh(spheres, 0, 1, opts);
+    auto t1 = std::chrono::steady_clock::now();
+    std::cout << " | " << num_threads << " threads: " << std::chrono::duration<double>(t1 - t0).count() * 1e3 << " ms";
+
+    if (num_threads == max_threads)
+      break;
+  }
+  std::cout << std::endl;
+}
+
+int main()
+{
+  const int num_rays = 200000;
+
+  for (const std::string mesh : {"teapot", "bunny", "dragon"})
+  {
+    const std::string mesh_file = "./examples/meshes/" + mesh + ".obj";
+    if (!std::ifstream(mesh_file))
+    {
+      std::cout << mesh << ": " << mesh_file << " not found, skipping" << std::endl;
+      continue;
+    }
+
+    auto triangles = load_triangles(mesh_file, nullptr);
+    AABB mesh_box;
+    triangles.bounding_box(0, 1, &mesh_box);
+    const auto rays = random_rays_through(mesh_box, num_rays);
+
+    std::cout << mesh << ": " << triangles.objects.size() << " triangles" << std::endl;
+
+    BVHBuildOptions median_opts;
+    median_opts.split_method = BVHSplitMethod::RandomMedian;
+    benchmark_builder("random median", triangles, rays, median_opts);
+
+    for (int max_leaf_size : {1, 2, 4, 8})
+    {
+      BVHBuildOptions sah_opts;
+      sah_opts.max_leaf_size = max_leaf_size;
+      benchmark_builder("SAH, max leaf " + std::to_string(max_leaf_size), triangles, rays, sah_opts);
+    }
+  }
+
+  for (int num_spheres : {10000, 100000, 1000000})
+    benchmark_build_scaling(num_spheres);
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+
+#include "bvh.h"
+#include "common.h"
+#include "render.h"
+#include "scenes.h"
+#include "wide_bvh.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Equal-time comparison of the integrators on cornell_box_hard: each one renders for about the same
+// time budget (seconds per integrator, first argument, default 30), and the result is compared with the
+// 10000 spp reference image. Error is the RMSE of the written pixel values (gamma-corrected, in [0, 1])
+// over all channels, since that's what the reference stores. Run times only roughly match the budget,
+// so RMSE x sqrt(time) is printed too: it stays constant for a Monte Carlo estimate that converges as
+// 1/sqrt(time), and is lower for the more efficient integrator. Run from the repo root.
+
+static const char *reference_file = "examples/images/cornell_hard_10000_spp.ppm";
+
+/// Pixel values of a plain (P3) ppm image, scaled to [0, 1]. Empty if it can't be read
+std::vector<double> read_ppm(std::istream &in, int *H, int *W)
+{
+  std::string magic;
+  int max_value = 0;
+  if (!(in >> magic >> *W >> *H >> max_value) || magic != "P3" || max_value <= 0)
+    return {};
+
+  std::vector<double> values(3 * size_t(*H) * *W);
+  for (auto &value : values)
+  {
+    int v;
+    if (!(in >> v))
+      return {};
+    value = double(v) / max_value;
+  }
+  return values;
+}
+
+double rmse(const std::vector<double> &a, const std::vector<double> &b)
+{
+  double sum = 0;
+  for (size_t i = 0; i < a.size(); ++i)
+    sum += (a[i] - b[i]) * (a[i] - b[i]);
+  return sqrt(sum / a.size());
+}
+
+struct RenderResult
+{
+  double seconds;
+  double rmse;
+};
+
+RenderResult render_and_compare(const Scene &scene, const Hittable &world, Integrator integrator, int spp,
+                                int H, int W, const std::vector<double> &reference)
+{
+  RenderOptions opts;
+  opts.print_progress = false;
+  opts.integrator = integrator;
+
+  std::ostringstream out;
+  auto start = std::chrono::steady_clock::now();
+  render(out, world, scene.lights, *scene.cam, H, W, scene.background, spp, 50, opts);
+  auto end = std::chrono::steady_clock::now();
+
+  std::istringstream in(out.str());
+  int image_H, image_W;
+  const std::vector<double> image = read_ppm(in, &image_H, &image_W);
+  return {std::chrono::duration<double>(end - start).count(), rmse(image, reference)};
+}
+
+int main(int argc, char **argv)
+{
+  const double budget_seconds = argc > 1 ? std::atof(argv[1]) : 30;
+
+  std::ifstream reference_in(reference_file);
+  int H, W;
+  const std::vector<double> reference = read_ppm(reference_in, &H, &W);
+  if (reference.empty())
+  {
+    std::cerr << "Could not read " << reference_file << "; run from the repo root" << std::endl;
+    return 1;
+  }
+
+  const Scene scene = cornell_box_hard();
+  const NativeWideBVH world(BVHNode(scene.objects, scene.cam->time0, scene.cam->time1), scene.cam->time0, scene.cam->time1);
+
+  std::cout << "cornell_box_hard, " << W << "x" << H << ", " << budget_seconds << " s per integrator" << std::endl;
+  for (const auto &[label, integrator] : {std::make_pair("mixture", Integrator::Mixture),
+                                          std::make_pair("next-event estimation", Integrator::NextEventEstimation)})
+  {
+    // Time a couple of samples per pixel, then render as many as fit in the budget
+    const int calibration_spp = 2;
+    const double seconds_per_spp = render_and_compare(scene, world, integrator, calibration_spp, H, W, reference).seconds / calibration_spp;
+    const int spp = std::max(1, static_cast<int>(budget_seconds / seconds_per_spp));
+
+    const RenderResult result = render_and_compare(scene, world, integrator, spp, H, W, reference);
+    std::cout << label
+              << " | spp: " << spp
+              << " | time: " << result.seconds << " s"
+              << " | RMSE: " << result.rmse
+              << " | RMSE x sqrt(time): " << result.rmse * sqrt(result.seconds) << std::endl;
+  }
+  return 0;
+}
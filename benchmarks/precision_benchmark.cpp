@@ -0,0 +1,111 @@
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+
+#include "common.h"
+#include "linear_bvh.h"
+#include "mesh.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Closest-hit throughput with primitives intersected in double vs float precision (single thread), and
+// how often the two disagree: rays that hit in one precision only, or whose distances differ by more
+// than 1e-4 relative. Meshes use random rays through their bounds, the marbles scene its camera rays.
+// Meshes that aren't checked into the repo (bunny, dragon) are skipped if missing.
+
+std::vector<Ray> random_rays_through(const AABB &box, int num_rays)
+{
+  const Point3 center = box.centroid();
+  const double radius = (box.max() - box.min()).length();
+
+  std::vector<Ray> rays;
+  rays.reserve(num_rays);
+  for (int i = 0; i < num_rays; ++i)
+  {
+    const Point3 origin = center + radius * random_unit_vector();
+    const Point3 target = box.min() + Vec3::random() * (box.max() - box.min());
+    rays.emplace_back(origin, target - origin);
+  }
+  return rays;
+}
+
+/// Distances of closest hits (infinity for misses), and rays per second
+std::vector<double> trace(const Hittable &world, const std::vector<Ray> &rays, double *rays_per_second)
+{
+  std::vector<double> distances(rays.size());
+  auto start = std::chrono::steady_clock::now();
+  hit_record rec;
+  for (size_t i = 0; i < rays.size(); ++i)
+    distances[i] = world.hit(rays[i], 0.001, infinity, &rec) ? rec.t : infinity;
+  auto end = std::chrono::steady_clock::now();
+
+  *rays_per_second = rays.size() / std::chrono::duration<double>(end - start).count();
+  return distances;
+}
+
+void compare_precisions(const std::string &label, const Hittable &world, const std::vector<Ray> &rays,
+                        const std::function<void(bool)> &set_single_precision)
+{
+  double double_rays_per_second, float_rays_per_second;
+  set_single_precision(false);
+  const auto double_t = trace(world, rays, &double_rays_per_second);
+  set_single_precision(true);
+  const auto float_t = trace(world, rays, &float_rays_per_second);
+
+  size_t num_mismatches = 0;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    const bool both_miss = double_t[i] == infinity && float_t[i] == infinity;
+    if (!both_miss && !(std::abs(double_t[i] - float_t[i]) <= 1e-4 * double_t[i]))
+      ++num_mismatches;
+  }
+
+  std::cout << label
+            << " | double: " << double_rays_per_second * 1e-6 << " Mrays/s"
+            << " | float: " << float_rays_per_second * 1e-6 << " Mrays/s"
+            << " | mismatches: " << 100.0 * num_mismatches / rays.size() << " %" << std::endl;
+}
+
+int main()
+{
+  const int num_rays = 500000;
+
+  for (const std::string mesh_name : {"teapot", "bunny", "dragon"})
+  {
+    const std::string mesh_file = "./examples/meshes/" + mesh_name + ".obj";
+    if (!std::ifstream(mesh_file))
+    {
+      std::cout << mesh_name << ": " << mesh_file << " not found, skipping" << std::endl;
+      continue;
+    }
+
+    TriangleMesh mesh(load_mesh_data(mesh_file), nullptr);
+    const auto rays = random_rays_through(mesh.box, num_rays);
+    compare_precisions(mesh_name + " (" + std::to_string(mesh.num_triangles) + " triangles)", mesh, rays,
+                       [&](bool single_precision)
+                       { mesh.single_precision = single_precision; });
+  }
+
+  Scene marbles = random_scene();
+  LinearBVH world(marbles.objects, 0, 1);
+  std::vector<Ray> camera_rays;
+  camera_rays.reserve(num_rays);
+  for (int i = 0; i < num_rays; ++i)
+    camera_rays.push_back(marbles.cam->get_ray(random_double(), random_double()));
+  compare_precisions("marbles (" + std::to_string(marbles.objects.objects.size()) + " spheres)", world, camera_rays,
+                     [&](bool single_precision)
+                     {
+                       for (const auto &object : marbles.objects.objects)
+                         if (auto sphere = std::dynamic_pointer_cast<Sphere>(object))
+                           sphere->single_precision = single_precision;
+                       world.refit(); // leaves intersect their own copies of the spheres
+                     });
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+#include "common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares throughput of libc rand() (shared global state) against the per-thread PCG32 generator
+// behind random_double(), with one thread and with all hardware threads drawing at once
+
+template <typename DrawFn>
+double draws_per_second(DrawFn draw, int num_threads, int draws_per_thread)
+{
+  std::vector<double> sums(num_threads, 0.0);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t)
+  {
+    threads.emplace_back([&, t]()
+                         {
+                           double sum = 0.0;
+                           for (int i = 0; i < draws_per_thread; ++i)
+                             sum += draw();
+                           sums[t] = sum; // keep draws from being optimized away
+                         });
+  }
+  for (auto &th : threads)
+    th.join();
+  auto end = std::chrono::steady_clock::now();
+
+  double checksum = 0.0;
+  for (double s : sums)
+    checksum += s;
+  if (checksum < 0)
+    std::cerr << checksum << std::endl;
+
+  const double seconds = std::chrono::duration<double>(end - start).count();
+  return double(num_threads) * draws_per_thread / seconds;
+}
+
+int main()
+{
+  const int draws_per_thread = 20000000;
+  const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  auto libc_rand = []()
+  { return rand() / (RAND_MAX + 1.0); };
+  auto pcg = []()
+  { return random_double(); };
+
+  for (int num_threads : {1, max_threads})
+  {
+    const double rand_rate = draws_per_second(libc_rand, num_threads, draws_per_thread);
+    const double pcg_rate = draws_per_second(pcg, num_threads, draws_per_thread);
+
+    std::cout << "threads: " << num_threads
+              << " | rand(): " << rand_rate * 1e-6 << " M/s"
+              << " | pcg32: " << pcg_rate * 1e-6 << " M/s"
+              << " | speedup: " << pcg_rate / rand_rate << "x" << std::endl;
+
+    if (max_threads == 1)
+      break;
+  }
+
+  return 0;
+}
@@ -0,0 +1,91 @@
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+
+#include "common.h"
+#include "linear_bvh.h"
+#include "render.h"
+#include "scenes.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+// Counts heap allocations made while tracing paths through the Cornell box scenes (single thread), to
+// check that shading a bounce doesn't allocate, and reports paths per second. Every replaceable operator
+// new and delete in the process goes through allocate() / release() below.
+
+static std::atomic<long> num_allocations(0);
+
+// Out of line, so the compiler doesn't see malloc / free inlined into code that calls new / delete, and
+// warn about them being mismatched
+__attribute__((noinline)) static void *allocate(size_t size, size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__) noexcept
+{
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  size = size ? size : 1;
+  if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+    return std::malloc(size);
+  return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+__attribute__((noinline)) static void release(void *p) noexcept { std::free(p); }
+
+static void *allocate_or_throw(size_t size, size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+{
+  if (void *p = allocate(size, alignment))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return allocate_or_throw(size); }
+void *operator new[](size_t size) { return allocate_or_throw(size); }
+void *operator new(size_t size, std::align_val_t al) { return allocate_or_throw(size, size_t(al)); }
+void *operator new[](size_t size, std::align_val_t al) { return allocate_or_throw(size, size_t(al)); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return allocate(size); }
+void *operator new(size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return allocate(size, size_t(al)); }
+void *operator new[](size_t size, std::align_val_t al, const std::nothrow_t &) noexcept { return allocate(size, size_t(al)); }
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, size_t) noexcept { release(p); }
+void operator delete[](void *p, size_t) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { release(p); }
+
+void measure(const std::string &label, const Scene &scene)
+{
+  const LinearBVH world(scene.objects, 0, 1);
+  const int num_paths = 200000;
+  const int max_depth = 50;
+
+  Color sum(0, 0, 0);
+  const long allocations_before = num_allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_paths; ++i)
+  {
+    rng::start_path(i, 0);
+    sum += ray_color(scene.cam->get_ray(random_double(), random_double()), scene.background, world,
+                     scene.lights.get(), max_depth);
+  }
+  auto end = std::chrono::steady_clock::now();
+  const long allocations = num_allocations.load() - allocations_before;
+
+  std::cout << label
+            << " | " << num_paths / std::chrono::duration<double>(end - start).count() * 1e-3 << " kpaths/s"
+            << " | allocations per path: " << double(allocations) / num_paths
+            << " | mean radiance: " << sum / num_paths << std::endl;
+}
+
+int main()
+{
+  measure("cornell_box", cornell_box());
+  measure("cornell_box_hard", cornell_box_hard());
+  return 0;
+}
@@ -1,12 +1,16 @@
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+
 #include "fluids/sph.h"
 
 #include "scenes.h"
 #include "bvh.h"
 #include "camera.h"
+#include "linear_bvh.h"
 #include "render.h"
 #include "timing.h"
 
 #include <limits>
+#include <optional>
 #include <vector>
 #include <fstream>
 #include <iostream>
@@ -60,6 +64,12 @@ int main()
     std::cout << "import numpy as np\ndata = np.array([" << std::endl;
   }
 
+  // Scene and BVHs are built for the first frame; later frames move the particle spheres and refit
+  std::optional<Scene> scene;
+  WaterParticles water_particles;
+  LinearBVH world_bvh;
+  int num_particle_bvh_rebuilds = 0;
+
   // Render
   for (int i = 0; i < num_steps; ++i)
   {
@@ -160,16 +170,28 @@ int main()
 
       std::cout << "Rendering frame " << frame_id << " / " << total_render_frames << " at sim step " << i << " to " << file_name << std::endl;
 
+      timing::Timer scene_timer("scene_update");
       std::vector<Point3> particle_positions(particles.size());
       for (int pi = 0; pi < static_cast<int>(particles.size()); ++pi)
         particle_positions[pi] = particles[pi].position;
 
-      Scene scene = water_in_box(box_size, particle_size, particle_positions);
-      auto world_bvh = BVHNode(scene.objects, /* time0 */ 0, /* time1 */ 9999);
+      if (!scene)
+      {
+        scene = water_in_box(box_size, particle_size, particle_positions, &water_particles);
+        world_bvh = LinearBVH(scene->objects, /* time0 */ 0, /* time1 */ 1);
+      }
+      else
+      {
+        num_particle_bvh_rebuilds += water_particles.cloud->move_particles(particle_positions);
+        world_bvh.refit();
+      }
+      scene_timer.stop();
 
       auto lights = shared_ptr<Hittable>();
 
-      render(outfile_stream, world_bvh, lights, *scene.cam, image_height, image_width, scene.background, samples_per_pixel, max_depth);
+      RenderOptions render_opts;
+      render_opts.print_progress = false; // we already log per frame
+      render(outfile_stream, world_bvh, lights, *scene->cam, image_height, image_width, scene->background, samples_per_pixel, max_depth, render_opts);
     }
     o_timer.stop();
   }
@@ -178,6 +200,7 @@ int main()
     std::cout << "])" << std::endl;
 
   sim_timer.stop();
+  std::cerr << "particle BVH rebuilds: " << num_particle_bvh_rebuilds << std::endl;
   timing::print(std::cerr);
 
   return 0;
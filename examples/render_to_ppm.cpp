@@ -2,9 +2,11 @@
 
 #include "bvh.h"
 #include "camera.h"
+#include "wide_bvh.h"
 #include "render.h"
 #include "scenes.h"
 #include "timing.h"
+#include "wavefront.h"
 
 #include <iostream>
 
@@ -14,9 +16,16 @@ int main()
   int image_width = 400;
   int samples_per_pixel = 200;
   int max_depth = 50;
+  bool wavefront = false; // breadth-first renderer; same image, different performance characteristics
+  RenderOptions render_opts;
+  render_opts.integrator = Integrator::Mixture; // NextEventEstimation converges faster with small lights
 
   int scene_id = 10;
 
+  // Set to a directory (e.g. "/tmp/bubbles_mesh_cache") to cache parsed meshes and their BVHs there, so
+  // that later runs skip parsing and BVH construction
+  mesh_cache::directory = "";
+
   // Build world
   timing::Timer build_scene_timer("build_scene");
   Scene scene;
@@ -64,12 +73,17 @@ int main()
   case 12:
     scene = stanford_dragon();
     break;
+  case 13: // 1000 instances of one mesh
+    scene = mesh_instances_field("./examples/meshes/teapot.obj", 1000);
+    break;
   default:
     std::cerr << "Invalid scene id: " << scene_id << std::endl;
     exit(1);
   }
-  auto world_bvh = BVHNode(scene.objects, /* time0 */ 0, /* time1 */ 9999);
+  const auto world_tree = BVHNode(scene.objects, scene.cam->time0, scene.cam->time1);
+  const auto world_bvh = NativeWideBVH(world_tree, scene.cam->time0, scene.cam->time1);
   build_scene_timer.stop();
+  std::cerr << "world BVH SAH cost: " << world_tree.sah_cost() << std::endl;
 
   std::cerr << "finished building scene; rendering!" << std::endl;
 
@@ -77,7 +91,10 @@ int main()
   int image_height = static_cast<int>(image_width / scene.cam->aspect_ratio);
 
   timing::Timer render_timer("render");
-  render(std::cout, world_bvh, scene.lights, *scene.cam, image_height, image_width, scene.background, samples_per_pixel, max_depth);
+  if (wavefront)
+    render_wavefront(std::cout, world_bvh, scene.lights, *scene.cam, image_height, image_width, scene.background, samples_per_pixel, max_depth, render_opts);
+  else
+    render(std::cout, world_bvh, scene.lights, *scene.cam, image_height, image_width, scene.background, samples_per_pixel, max_depth, render_opts);
   render_timer.stop();
 
   timing::print(std::cerr);
@@ -2,47 +2,71 @@
 
 #include "common.h"
 
-class AABB
+#include <limits>
+#include <utility>
+
+/// Slab tests are conservative only if the exit distance is padded for rounding error; see "Physically
+/// Based Rendering" 3rd ed., section 3.9.2
+template <typename Scalar>
+constexpr Scalar slab_exit_padding = 1 + 2 * 3 * Scalar(0.5) * std::numeric_limits<Scalar>::epsilon();
+
+/// Axis-aligned box with Scalar (double or float) corners; see Vec3T
+template <typename Scalar>
+class AABBT
 {
 public:
-  AABB() {}
-  AABB(const Point3 &a, const Point3 &b) : minimum(a), maximum(b)
+  AABBT() {}
+  AABBT(const Vec3T<Scalar> &a, const Vec3T<Scalar> &b) : minimum(a), maximum(b)
   {
   }
 
-  Point3 min() const { return minimum; }
-  Point3 max() const { return maximum; }
+  Vec3T<Scalar> min() const { return minimum; }
+  Vec3T<Scalar> max() const { return maximum; }
+
+  Vec3T<Scalar> centroid() const { return Scalar(0.5) * (minimum + maximum); }
+
+  Scalar surface_area() const
+  {
+    const Vec3T<Scalar> d = maximum - minimum;
+    return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+  }
 
-  bool hit(const Ray &r, double t_min, double t_max) const
+  bool hit(const RayT<Scalar> &r, Scalar t_min, Scalar t_max) const
   {
     for (int a = 0; a < 3; ++a)
     {
-      auto invD = 1.0f / r.direction()[a];
-      auto t0 = (minimum[a] - r.origin()[a]) * invD;
-      auto t1 = (maximum[a] - r.origin()[a]) * invD;
-      if (invD < 0.0f)
+      const Scalar inv_d = 1 / r.direction()[a];
+      Scalar t0 = (minimum[a] - r.origin()[a]) * inv_d;
+      Scalar t1 = (maximum[a] - r.origin()[a]) * inv_d;
+      if (inv_d < 0)
         std::swap(t0, t1);
+      t1 *= slab_exit_padding<Scalar>;
+
+      // Written so that NaNs (0 * inf, for rays in the plane of a slab) leave the interval unchanged
       t_min = t0 > t_min ? t0 : t_min;
       t_max = t1 < t_max ? t1 : t_max;
-      if (t_max <= t_min)
+      if (t_min > t_max)
         return false;
     }
     return true;
   }
 
-  Point3 minimum;
-  Point3 maximum;
+  Vec3T<Scalar> minimum;
+  Vec3T<Scalar> maximum;
 };
 
-AABB surrounding_box(const AABB &box0, const AABB &box1)
+using AABB = AABBT<double>;
+
+template <typename Scalar>
+AABBT<Scalar> surrounding_box(const AABBT<Scalar> &box0, const AABBT<Scalar> &box1)
 {
-  Point3 small(fmin(box0.min().x(), box1.min().x()),
-               fmin(box0.min().y(), box1.min().y()),
-               fmin(box0.min().z(), box1.min().z()));
+  Vec3T<Scalar> small(std::min(box0.min().x(), box1.min().x()),
+                      std::min(box0.min().y(), box1.min().y()),
+                      std::min(box0.min().z(), box1.min().z()));
 
-  Point3 big(fmax(box0.max().x(), box1.max().x()),
-             fmax(box0.max().y(), box1.max().y()),
-             fmax(box0.max().z(), box1.max().z()));
+  Vec3T<Scalar> big(std::max(box0.max().x(), box1.max().x()),
+                    std::max(box0.max().y(), box1.max().y()),
+                    std::max(box0.max().z(), box1.max().z()));
 
-  return AABB(small, big);
-}
\ No newline at end of file
+  return AABBT<Scalar>(small, big);
+}
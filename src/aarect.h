@@ -7,7 +7,7 @@
 // AlignedAxis: axis that plane is defined in. 0, 1, 2 = x, y, z
 // variable names in methods use x, y assuming z-aligned, but this class is general to xyz
 template <int AlignedAxis = 2>
-class AARect : public Hittable
+class AARect final : public Hittable
 {
 public:
   AARect() {}
@@ -33,6 +33,29 @@ public:
 
   virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override;
 
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    double x, y;
+    return intersect(r, t_min, t_max, t, &x, &y);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    double t, x, y;
+    if (!intersect(r, t_min, t_max, &t, &x, &y))
+      return false;
+    result->t = t;
+    result->object = this;
+    result->u = x;
+    result->v = y;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override
+  {
+    set_attributes(r, hit.t, hit.u, hit.v, rec);
+  }
+
   virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
   {
     // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -51,13 +74,13 @@ public:
 
   virtual double pdf_value(const Point3 &origin, const Vec3 &v) const override
   {
-    hit_record rec;
-    if (!this->hit(Ray(origin, v), 0.001, infinity, &rec))
+    double t;
+    if (!this->hit_distance(Ray(origin, v), 0.001, infinity, &t))
       return 0;
 
     const double area = (x1 - x0) * (y1 - y0);
-    auto distance_squared = rec.t * rec.t * v.length_squared();
-    auto cosine = fabs(dot(v, rec.normal) / v.length());
+    auto distance_squared = t * t * v.length_squared();
+    auto cosine = fabs(v[AlignedAxis] / v.length());
 
     const double solid_angle = area * cosine / distance_squared;
     const double pdf_val = 1 / solid_angle;
@@ -78,20 +101,45 @@ public:
   shared_ptr<Material> mp;
 
   std::pair<int, int> axes;
+
+private:
+  /// Distance and in-plane coordinates of hit. Outputs are only written on a hit, since aggregates pass
+  /// their closest t so far to hit_distance()
+  bool intersect(const Ray &r, double t_min, double t_max, double *t, double *x, double *y) const
+  {
+    const double t_hit = (k - r.origin()[AlignedAxis]) / r.direction()[AlignedAxis];
+    if (t_hit < t_min || t_hit > t_max)
+      return false;
+
+    const double x_hit = r.origin()[axes.first] + t_hit * r.direction()[axes.first];
+    const double y_hit = r.origin()[axes.second] + t_hit * r.direction()[axes.second];
+    if (x_hit < x0 || x_hit > x1 || y_hit < y0 || y_hit > y1)
+      return false;
+
+    *t = t_hit;
+    *x = x_hit;
+    *y = y_hit;
+    return true;
+  }
+
+  /// Attributes of the hit at distance t and in-plane coordinates x, y
+  void set_attributes(const Ray &r, double t, double x, double y, hit_record *rec) const;
 };
 
 template <int AlignedAxis>
 bool AARect<AlignedAxis>::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
 {
-  auto t = (k - r.origin()[AlignedAxis]) / r.direction()[AlignedAxis];
-  if (t < t_min || t > t_max)
+  double t, x, y;
+  if (!intersect(r, t_min, t_max, &t, &x, &y))
     return false;
 
-  auto x = r.origin()[axes.first] + t * r.direction()[axes.first];
-  auto y = r.origin()[axes.second] + t * r.direction()[axes.second];
-  if (x < x0 || x > x1 || y < y0 || y > y1)
-    return false;
+  set_attributes(r, t, x, y, rec);
+  return true;
+}
 
+template <int AlignedAxis>
+void AARect<AlignedAxis>::set_attributes(const Ray &r, double t, double x, double y, hit_record *rec) const
+{
   rec->u = (x - x0) / (x1 - x0);
   rec->v = (y - y0) / (y1 - y0);
   rec->t = t;
@@ -100,9 +148,8 @@ bool AARect<AlignedAxis>::hit(const Ray &r, double t_min, double t_max, hit_reco
   pos_normal[AlignedAxis] = 1; // arbitrary
 
   rec->set_face_normal(r, pos_normal);
-  rec->mat_ptr = mp;
+  rec->mat_ptr = mp.get();
   rec->p = r.at(t);
-  return true;
 }
 
 using YZRect = AARect<0>;
@@ -2,10 +2,16 @@
 
 #include "common.h"
 
-#include "aarect.h"
-#include "hittable_list.h"
+#include "hittable.h"
 
-class Box : public Hittable
+#include <utility>
+
+/// Axis-aligned box, intersected with one slab test: the face hit is the one whose slab the ray enters
+/// last (or, from inside, leaves first). Faces have outward normals, and uv like the AARect on that face.
+///
+/// For importance sampling, points are sampled uniformly over the faces that face the origin (or over all
+/// faces from inside the box), so that samples don't land on the box's far side where it occludes them.
+class Box final : public Hittable
 {
 public:
   Box() {}
@@ -13,6 +19,31 @@ public:
 
   virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override;
 
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    int axis;
+    bool max_face;
+    return intersect(r, t_min, t_max, t, &axis, &max_face);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    double t;
+    int axis;
+    bool max_face;
+    if (!intersect(r, t_min, t_max, &t, &axis, &max_face))
+      return false;
+    result->t = t;
+    result->object = this;
+    result->prim = 2 * axis + max_face;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override
+  {
+    set_attributes(r, hit.t, hit.prim / 2, hit.prim % 2, rec);
+  }
+
   virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
   {
     *output_box = AABB(box_min, box_max);
@@ -25,45 +56,167 @@ public:
 public:
   Point3 box_min;
   Point3 box_max;
-  std::vector<shared_ptr<Hittable> > sides;
-  HittableList sides_hittable;
+  shared_ptr<Material> mp;
+
+private:
+  /// Closest intersection in [t_min, t_max]: distance, and which face (axis, and min or max side)
+  bool intersect(const Ray &r, double t_min, double t_max, double *t, int *axis, bool *max_face) const;
+
+  /// Attributes of the hit at distance t on the given face
+  void set_attributes(const Ray &r, double t, int axis, bool max_face, hit_record *rec) const;
+
+  /// Axes spanning the face perpendicular to axis, in the order AARect uses for uv
+  static std::pair<int, int> face_axes(int axis)
+  {
+    return axis == 0 ? std::make_pair(1, 2) : axis == 1 ? std::make_pair(0, 2) : std::make_pair(0, 1);
+  }
+
+  double face_area(int axis) const
+  {
+    const auto [a, b] = face_axes(axis);
+    return (box_max[a] - box_min[a]) * (box_max[b] - box_min[b]);
+  }
+
+  /// Faces to sample from origin: bit 2 * axis + max_face is set for each face that faces origin, or for
+  /// all faces if origin is inside the box
+  int sampled_faces(const Point3 &origin) const
+  {
+    int faces = 0;
+    for (int a = 0; a < 3; ++a)
+    {
+      faces |= (origin[a] < box_min[a]) << (2 * a);
+      faces |= (origin[a] > box_max[a]) << (2 * a + 1);
+    }
+    return faces ? faces : 0x3f;
+  }
+
+  double sampled_area(int faces) const
+  {
+    double area = 0;
+    for (int face = 0; face < 6; ++face)
+      if (faces & (1 << face))
+        area += face_area(face / 2);
+    return area;
+  }
 };
 
-Box::Box(const Point3 &p0, const Point3 &p1, shared_ptr<Material> ptr)
+Box::Box(const Point3 &p0, const Point3 &p1, shared_ptr<Material> ptr) : box_min(p0), box_max(p1), mp(ptr)
 {
   for (int i = 0; i < 3; ++i)
     assert(p0[i] <= p1[i]);
+}
 
-  box_min = p0;
-  box_max = p1;
-
-  sides.push_back(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-  sides.push_back(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-
-  sides.push_back(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-  sides.push_back(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-
-  sides.push_back(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-  sides.push_back(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
+bool Box::intersect(const Ray &r, double t_min, double t_max, double *t, int *axis, bool *max_face) const
+{
+  double t_enter = -infinity, t_exit = infinity;
+  int enter_axis = 0, exit_axis = 0;
+  for (int a = 0; a < 3; ++a)
+  {
+    const double inv_d = 1.0 / r.direction()[a];
+    double t0 = (box_min[a] - r.origin()[a]) * inv_d;
+    double t1 = (box_max[a] - r.origin()[a]) * inv_d;
+    if (t0 > t1)
+      std::swap(t0, t1);
+
+    // Written so that NaNs (0 * inf, for rays in the plane of a face) leave the interval unchanged
+    if (t0 > t_enter)
+    {
+      t_enter = t0;
+      enter_axis = a;
+    }
+    if (t1 < t_exit)
+    {
+      t_exit = t1;
+      exit_axis = a;
+    }
+  }
+  if (t_enter > t_exit)
+    return false;
 
-  for (const auto &s : sides)
-    sides_hittable.add(s);
+  // Ray enters through the near face, or if that's out of range (e.g. it starts inside), leaves through the far one
+  if (t_enter >= t_min && t_enter <= t_max)
+  {
+    *t = t_enter;
+    *axis = enter_axis;
+    *max_face = r.direction()[enter_axis] < 0;
+    return true;
+  }
+  if (t_exit >= t_min && t_exit <= t_max)
+  {
+    *t = t_exit;
+    *axis = exit_axis;
+    *max_face = r.direction()[exit_axis] > 0;
+    return true;
+  }
+  return false;
 }
 
 bool Box::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
 {
-  return sides_hittable.hit(r, t_min, t_max, rec);
+  double t;
+  int axis;
+  bool max_face;
+  if (!intersect(r, t_min, t_max, &t, &axis, &max_face))
+    return false;
+
+  set_attributes(r, t, axis, max_face, rec);
+  return true;
+}
+
+void Box::set_attributes(const Ray &r, double t, int axis, bool max_face, hit_record *rec) const
+{
+  rec->t = t;
+  rec->p = r.at(rec->t);
+  const auto [a, b] = face_axes(axis);
+  rec->u = (rec->p[a] - box_min[a]) / (box_max[a] - box_min[a]);
+  rec->v = (rec->p[b] - box_min[b]) / (box_max[b] - box_min[b]);
+
+  Vec3 outward_normal(0, 0, 0);
+  outward_normal[axis] = max_face ? 1 : -1;
+  rec->set_face_normal(r, outward_normal);
+  rec->mat_ptr = mp.get();
 }
 
 double Box::pdf_value(const Point3 &origin, const Vec3 &v) const
 {
-  double pdf_val = 0;
-  for (const auto &s : sides)
-    pdf_val += s->pdf_value(origin, v);
-  return pdf_val / sides.size();
+  double t;
+  int axis;
+  bool max_face;
+  if (!intersect(Ray(origin, v), 0.001, infinity, &t, &axis, &max_face))
+    return 0;
+
+  // Uniform over the sampled faces' area, converted to solid angle at the face that was hit
+  const int faces = sampled_faces(origin);
+  if (!(faces & (1 << (2 * axis + max_face))))
+    return 0;
+  const double distance_squared = t * t * v.length_squared();
+  const double cosine = fabs(v[axis] / v.length());
+  return distance_squared / (cosine * sampled_area(faces));
 }
 
 Vec3 Box::random(const Point3 &origin) const
 {
-  return sides[random_int(0, 5)]->random(origin);
+  // Pick a face with probability proportional to its area, then a point on it
+  const int faces = sampled_faces(origin);
+  double pick = random_double() * sampled_area(faces);
+  int face = 0;
+  for (; face < 5; ++face)
+  {
+    if (!(faces & (1 << face)))
+      continue;
+    pick -= face_area(face / 2);
+    if (pick < 0)
+      break;
+  }
+  // Rounding can run past the last sampled face
+  while (!(faces & (1 << face)))
+    --face;
+
+  const int axis = face / 2;
+  const auto [a, b] = face_axes(axis);
+  Point3 random_point;
+  random_point[axis] = face & 1 ? box_max[axis] : box_min[axis];
+  random_point[a] = random_double(box_min[a], box_max[a]);
+  random_point[b] = random_double(box_min[b], box_max[b]);
+  return random_point - origin;
 }
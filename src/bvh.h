@@ -4,8 +4,11 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "parallel.h"
 
 #include <algorithm>
+#include <thread>
+#include <vector>
 
 inline bool box_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b, int axis)
 {
@@ -33,35 +36,263 @@ bool box_z_compare(const shared_ptr<Hittable> a, const shared_ptr<Hittable> b)
   return box_compare(a, b, 2);
 }
 
+enum class BVHSplitMethod
+{
+  SAH,         // binned surface area heuristic; picks axis and split position by estimated traversal cost
+  RandomMedian // original builder: random axis, split at median object. Kept around for comparisons
+};
+
+struct BVHBuildOptions
+{
+  BVHSplitMethod split_method = BVHSplitMethod::SAH;
+  int max_leaf_size = 4; // nodes with more primitives than this are always split
+  int num_bins = 16;     // candidate split positions per axis, for SAH
+  int num_threads = std::max(1u, std::thread::hardware_concurrency()); // SAH only
+};
+
+namespace bvh
+{
+  // SAH costs, relative to the cost of intersecting one primitive
+  static constexpr double traversal_cost = 1.0;
+  static constexpr double intersection_cost = 1.0;
+
+  // Subtrees with fewer primitives than this are built on the thread that created their parent, since
+  // starting a thread would cost more than the build itself
+  static constexpr size_t parallel_build_min_primitives = 4096;
+
+  /// Primitive as seen by the builder: only its bounds matter
+  struct BuildPrimitive
+  {
+    AABB box;
+    Point3 centroid;
+    size_t index; // into caller's primitive array
+  };
+
+  struct Split
+  {
+    int axis;
+    size_t mid;  // primitives [begin, mid) go left, [mid, end) go right
+    double cost; // SAH cost of splitting here, including traversal of this node
+  };
+
+  inline AABB bounds(const BuildPrimitive *prims, size_t begin, size_t end)
+  {
+    AABB box = prims[begin].box;
+    for (size_t i = begin + 1; i < end; ++i)
+      box = surrounding_box(box, prims[i].box);
+    return box;
+  }
+
+  /// Find best split of prims[begin, end) by binning centroids along each axis, and partition the range
+  /// accordingly. Returns false if primitives can't be separated (e.g. all centroids coincide).
+  inline bool find_sah_split(BuildPrimitive *prims, size_t begin, size_t end, const AABB &node_box, int num_bins, Split *split)
+  {
+    AABB centroid_box(prims[begin].centroid, prims[begin].centroid);
+    for (size_t i = begin + 1; i < end; ++i)
+      centroid_box = surrounding_box(centroid_box, AABB(prims[i].centroid, prims[i].centroid));
+
+    struct Bin
+    {
+      AABB box;
+      size_t count = 0;
+    };
+
+    const double node_area = node_box.surface_area();
+    split->cost = infinity;
+    int best_bin = -1;
+    std::vector<Bin> bins(num_bins);
+    std::vector<double> right_area(num_bins);
+    std::vector<size_t> right_count(num_bins);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      const double c_min = centroid_box.min()[axis];
+      const double extent = centroid_box.max()[axis] - c_min;
+      if (extent <= 0)
+        continue;
+      const double bin_scale = num_bins / extent;
+
+      std::fill(bins.begin(), bins.end(), Bin());
+      for (size_t i = begin; i < end; ++i)
+      {
+        int b = std::min(num_bins - 1, static_cast<int>((prims[i].centroid[axis] - c_min) * bin_scale));
+        bins[b].box = bins[b].count == 0 ? prims[i].box : surrounding_box(bins[b].box, prims[i].box);
+        bins[b].count++;
+      }
+
+      // Sweep from the right to get area and count of everything right of each candidate plane...
+      AABB acc_box;
+      size_t acc_count = 0;
+      for (int b = num_bins - 1; b > 0; --b)
+      {
+        if (bins[b].count > 0)
+        {
+          acc_box = acc_count == 0 ? bins[b].box : surrounding_box(acc_box, bins[b].box);
+          acc_count += bins[b].count;
+        }
+        right_area[b] = acc_count > 0 ? acc_box.surface_area() : 0;
+        right_count[b] = acc_count;
+      }
+
+      // ... then from the left, evaluating the cost of the plane between bin b-1 and b
+      acc_count = 0;
+      for (int b = 1; b < num_bins; ++b)
+      {
+        if (bins[b - 1].count > 0)
+        {
+          acc_box = acc_count == 0 ? bins[b - 1].box : surrounding_box(acc_box, bins[b - 1].box);
+          acc_count += bins[b - 1].count;
+        }
+        if (acc_count == 0 || right_count[b] == 0)
+          continue;
+
+        const double cost = traversal_cost + intersection_cost *
+                                                 (acc_box.surface_area() * acc_count + right_area[b] * right_count[b]) /
+                                                 node_area;
+        if (cost < split->cost)
+        {
+          split->cost = cost;
+          split->axis = axis;
+          best_bin = b;
+        }
+      }
+    }
+
+    if (best_bin < 0)
+      return false;
+
+    const int axis = split->axis;
+    const double c_min = centroid_box.min()[axis];
+    const double bin_scale = num_bins / (centroid_box.max()[axis] - c_min);
+    auto mid_it = std::partition(prims + begin, prims + end, [&](const BuildPrimitive &p)
+                                 { return std::min(num_bins - 1, static_cast<int>((p.centroid[axis] - c_min) * bin_scale)) < best_bin; });
+    split->mid = mid_it - prims;
+    return true;
+  }
+}
+
 class BVHNode : public Hittable
 {
 public:
-  BVHNode(HittableList list, double time0, double time1)
-      : BVHNode(list.objects, 0, list.objects.size(), time0, time1)
+  BVHNode() = default;
+
+  BVHNode(HittableList list, double time0, double time1, const BVHBuildOptions &opts = BVHBuildOptions())
+      : BVHNode(list.objects, 0, list.objects.size(), time0, time1, opts)
   {
   }
 
   BVHNode(
       std::vector<shared_ptr<Hittable> > &objects,
-      size_t start_idx, size_t end_idx, double time0, double time1);
+      size_t start_idx, size_t end_idx, double time0, double time1,
+      const BVHBuildOptions &opts = BVHBuildOptions());
 
-  virtual bool hit(
-      const Ray &r, double t_min, double t_max, hit_record *rec) const override;
+  virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override;
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override;
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override;
 
   virtual bool bounding_box(double time0, double time1, AABB *output_box) const override;
 
+  bool is_leaf() const { return !primitives.empty(); }
+
+  /// Expected cost of a ray query against this tree, in units of primitive intersections, assuming
+  /// rays are distributed uniformly over the root box. Lower is better
+  double sah_cost() const;
+
+  // Interior nodes have two children; leaves have a list of primitives instead
   shared_ptr<Hittable> left;
   shared_ptr<Hittable> right;
+  std::vector<shared_ptr<Hittable> > primitives;
   AABB box;
+
+private:
+  void build_sah(const std::vector<shared_ptr<Hittable> > &objects, bvh::BuildPrimitive *prims, size_t begin, size_t end, const BVHBuildOptions &opts, int num_threads);
+
+  void build_random_median(std::vector<shared_ptr<Hittable> > &objects, size_t start_idx, size_t end_idx, double time0, double time1, const BVHBuildOptions &opts);
 };
 
 BVHNode::BVHNode(
     std::vector<shared_ptr<Hittable> > &objects,
-    size_t start_idx, size_t end_idx, double time0, double time1)
+    size_t start_idx, size_t end_idx, double time0, double time1,
+    const BVHBuildOptions &opts)
 {
-
   assert(objects.size() > 0);
+  assert(start_idx < end_idx);
+
+  if (opts.split_method == BVHSplitMethod::RandomMedian)
+  {
+    build_random_median(objects, start_idx, end_idx, time0, time1, opts);
+    return;
+  }
+
+  std::vector<bvh::BuildPrimitive> prims(end_idx - start_idx);
+  parallel_for(static_cast<int>(prims.size()), opts.num_threads, [&](int begin, int end)
+               {
+                 for (int k = begin; k < end; ++k)
+                 {
+                   auto &p = prims[k];
+                   if (!objects[start_idx + k]->bounding_box(time0, time1, &p.box))
+                     std::cerr << "No bounding box in BVHNode constructor." << std::endl;
+                   p.centroid = p.box.centroid();
+                   p.index = start_idx + k;
+                 }
+               },
+               bvh::parallel_build_min_primitives);
 
+  build_sah(objects, prims.data(), 0, prims.size(), opts, opts.num_threads);
+}
+
+/// Subtrees are built in parallel: a node with enough primitives hands its left subtree to a new thread
+/// along with half of its thread budget. Subtrees work on disjoint ranges of prims, and splits don't
+/// depend on which thread builds them, so the tree is the same for any number of threads.
+void BVHNode::build_sah(const std::vector<shared_ptr<Hittable> > &objects, bvh::BuildPrimitive *prims, size_t begin, size_t end, const BVHBuildOptions &opts, int num_threads)
+{
+  box = bvh::bounds(prims, begin, end);
+  const size_t count = end - begin;
+
+  bvh::Split split;
+  bool can_split = count > 1 && bvh::find_sah_split(prims, begin, end, box, opts.num_bins, &split);
+
+  const double leaf_cost = bvh::intersection_cost * count;
+  const bool make_leaf = count == 1 || (count <= static_cast<size_t>(opts.max_leaf_size) && (!can_split || leaf_cost <= split.cost));
+
+  if (make_leaf)
+  {
+    for (size_t i = begin; i < end; ++i)
+      primitives.push_back(objects[prims[i].index]);
+    return;
+  }
+
+  if (!can_split)
+  {
+    // Too many primitives for a leaf, but they all share a centroid: any split is as good as another
+    split.mid = begin + count / 2;
+  }
+
+  auto left_node = make_shared<BVHNode>();
+  auto right_node = make_shared<BVHNode>();
+  if (num_threads > 1 && count >= bvh::parallel_build_min_primitives)
+  {
+    const int left_threads = num_threads / 2;
+    std::thread left_builder([&]()
+                             { left_node->build_sah(objects, prims, begin, split.mid, opts, left_threads); });
+    right_node->build_sah(objects, prims, split.mid, end, opts, num_threads - left_threads);
+    left_builder.join();
+  }
+  else
+  {
+    left_node->build_sah(objects, prims, begin, split.mid, opts, 1);
+    right_node->build_sah(objects, prims, split.mid, end, opts, 1);
+  }
+  left = left_node;
+  right = right_node;
+}
+
+void BVHNode::build_random_median(std::vector<shared_ptr<Hittable> > &objects, size_t start_idx, size_t end_idx, double time0, double time1, const BVHBuildOptions &opts)
+{
   int axis = random_int(0, 2);
   auto comparator = (axis == 0)   ? box_x_compare
                     : (axis == 1) ? box_y_compare
@@ -69,36 +300,32 @@ BVHNode::BVHNode(
 
   size_t object_span = end_idx - start_idx;
 
-  if (object_span == 1)
-  {
-    left = right = objects[start_idx];
-  }
-  else if (object_span == 2)
+  if (object_span <= 2)
   {
-    if (comparator(objects[start_idx], objects[start_idx + 1]))
-    {
-      left = objects[start_idx];
-      right = objects[start_idx + 1];
-    }
-    else
+    primitives.assign(objects.begin() + start_idx, objects.begin() + end_idx);
+    if (object_span == 2 && !comparator(primitives[0], primitives[1]))
+      std::swap(primitives[0], primitives[1]);
+
+    box = AABB();
+    for (size_t i = 0; i < primitives.size(); ++i)
     {
-      left = objects[start_idx + 1];
-      right = objects[start_idx];
+      AABB prim_box;
+      if (!primitives[i]->bounding_box(time0, time1, &prim_box))
+        std::cerr << "No bounding box in BVHNode constructor." << std::endl;
+      box = i == 0 ? prim_box : surrounding_box(box, prim_box);
     }
+    return;
   }
-  else
-  {
-    std::sort(objects.begin() + start_idx, objects.begin() + end_idx, comparator);
 
-    auto mid_idx = start_idx + object_span / 2;
-    left = make_shared<BVHNode>(objects, start_idx, mid_idx, time0, time1);
-    right = make_shared<BVHNode>(objects, mid_idx, end_idx, time0, time1);
-  }
+  std::sort(objects.begin() + start_idx, objects.begin() + end_idx, comparator);
 
-  AABB box_left, box_right;
-  if (!left->bounding_box(time0, time1, &box_left) || !right->bounding_box(time0, time1, &box_right))
-    std::cerr << "No bounding box in BVHNode constructor." << std::endl;
+  auto mid_idx = start_idx + object_span / 2;
+  left = make_shared<BVHNode>(objects, start_idx, mid_idx, time0, time1, opts);
+  right = make_shared<BVHNode>(objects, mid_idx, end_idx, time0, time1, opts);
 
+  AABB box_left, box_right;
+  left->bounding_box(time0, time1, &box_left);
+  right->bounding_box(time0, time1, &box_right);
   box = surrounding_box(box_left, box_right);
 }
 
@@ -108,13 +335,99 @@ bool BVHNode::bounding_box(double /*time0*/, double /*time1*/, AABB *output_box)
   return true;
 }
 
-bool BVHNode::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
+bool BVHNode::intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const
 {
   if (!box.hit(r, t_min, t_max))
     return false;
 
-  bool hit_left = left->hit(r, t_min, t_max, rec);
-  bool hit_right = right->hit(r, t_min, hit_left ? rec->t : t_max, rec); // does right hit earlier?
+  if (is_leaf())
+  {
+    bool hit_anything = false;
+    for (const auto &prim : primitives)
+    {
+      if (prim->intersect(r, t_min, t_max, result))
+      {
+        hit_anything = true;
+        t_max = result->t;
+      }
+    }
+    return hit_anything;
+  }
+
+  bool hit_left = left->intersect(r, t_min, t_max, result);
+  bool hit_right = right->intersect(r, t_min, hit_left ? result->t : t_max, result); // does right hit earlier?
 
   return hit_left || hit_right;
 }
+
+bool BVHNode::hit_distance(const Ray &r, double t_min, double t_max, double *t) const
+{
+  if (!box.hit(r, t_min, t_max))
+    return false;
+
+  if (is_leaf())
+  {
+    bool hit_anything = false;
+    for (const auto &prim : primitives)
+    {
+      if (prim->hit_distance(r, t_min, t_max, t))
+      {
+        hit_anything = true;
+        t_max = *t;
+      }
+    }
+    return hit_anything;
+  }
+
+  bool hit_left = left->hit_distance(r, t_min, t_max, t);
+  bool hit_right = right->hit_distance(r, t_min, hit_left ? *t : t_max, t);
+
+  return hit_left || hit_right;
+}
+
+bool BVHNode::occluded(const Ray &r, double t_min, double t_max) const
+{
+  if (!box.hit(r, t_min, t_max))
+    return false;
+
+  if (is_leaf())
+  {
+    for (const auto &prim : primitives)
+    {
+      if (prim->occluded(r, t_min, t_max))
+        return true;
+    }
+    return false;
+  }
+
+  return left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max);
+}
+
+double BVHNode::sah_cost() const
+{
+  // Nested BVHs (e.g. meshes) count with their own cost instead of as a single primitive
+  auto child_cost = [](const shared_ptr<Hittable> &child)
+  {
+    auto child_bvh = std::dynamic_pointer_cast<BVHNode>(child);
+    return child_bvh ? child_bvh->sah_cost() : bvh::intersection_cost;
+  };
+
+  if (is_leaf())
+  {
+    double cost = 0;
+    for (const auto &prim : primitives)
+      cost += child_cost(prim);
+    return cost;
+  }
+
+  AABB box_left, box_right;
+  left->bounding_box(0, 1, &box_left);
+  right->bounding_box(0, 1, &box_right);
+
+  const double area = box.surface_area();
+  if (area <= 0)
+    return bvh::traversal_cost + child_cost(left) + child_cost(right);
+
+  return bvh::traversal_cost +
+         (box_left.surface_area() * child_cost(left) + box_right.surface_area() * child_cost(right)) / area;
+}
@@ -41,6 +41,7 @@ public:
   }
 
   double aspect_ratio;
+  double time0, time1; // shutter open/close times
 
 private:
   Point3 origin;
@@ -50,5 +51,4 @@ private:
 
   Vec3 u, v, w;
   double lens_radius;
-  double time0, time1; // shutter open/close times
 };
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <cassert>
 #include <cmath>
 #include <limits>
 #include <memory>
 #include <cstdlib>
 
+#include "rng.h"
+
 // Usings
 using std::make_shared;
 using std::shared_ptr;
@@ -31,8 +34,8 @@ inline double clamp(double x, double min, double max)
 
 inline double random_double()
 {
-  // Returns a random real in [0,1).
-  return rand() / (RAND_MAX + 1.0);
+  // Returns a random real in [0,1). Draws from this thread's generator; see rng.h for seeding
+  return rng::thread_generator().next_double();
 }
 
 inline double random_double(double min, double max)
@@ -76,7 +76,7 @@ bool ConstantMedium::hit(const Ray &r, double t_min, double t_max, hit_record *r
     rec->p = r.at(rec->t);
     rec->normal = Vec3(1, 0, 0); // arbitrary
     rec->front_face = true;      // also arbitrary
-    rec->mat_ptr = phase_function;
+    rec->mat_ptr = phase_function.get();
 
     return true;
 }
\ No newline at end of file
@@ -4,12 +4,14 @@
 #include "ray.h"
 #include "common.h"
 
+#include <cstdint>
+
 class Material;
 struct hit_record
 {
   Point3 p;
   Vec3 normal; // normal will always face outwards
-  shared_ptr<Material> mat_ptr;
+  const Material *mat_ptr = nullptr; // owned by the hit object, which outlives the hit record
   double t;
   double u;
   double v;
@@ -22,6 +24,20 @@ struct hit_record
   }
 };
 
+class Hittable;
+
+/// Closest hit found by traversal before its surface attributes are computed: the distance, plus what
+/// the object that was hit needs to compute the attributes afterwards, for the winning hit only. Objects
+/// that don't defer their attributes compute the full hit_record right away and keep it in eager_rec
+struct surface_hit
+{
+  double t;
+  const Hittable *object; // computes the attributes, with surface_attributes()
+  uint32_t prim;          // which of object's primitives was hit, e.g. triangle of a mesh
+  double u, v;            // e.g. barycentric coordinates
+  hit_record eager_rec;
+};
+
 // For debugging
 inline std::ostream &operator<<(std::ostream &out, const hit_record &rec)
 {
@@ -38,223 +54,72 @@ public:
   virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const = 0;
   virtual bool bounding_box(double time0, double time1, AABB *output_box) const = 0;
 
-  // Methods for supporting importance sampling with HittablePDF
-  // Compute probability of sampling a given vector from random(o) method
-  virtual double pdf_value(const Point3 & /*origin*/, const Vec3 & /*v*/) const
+  // Closest hit in two phases, so that attributes (normal, uv, ...) are only computed for the hit that
+  // ends up closest, instead of for every candidate. Aggregates forward intersect() to their children,
+  // and implement hit() with deferred_hit()
+
+  /// Closest hit in [t_min, t_max], without its surface attributes. Writes result only on a hit. Default
+  /// computes the whole hit_record right away
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const
   {
-    std::cerr << "Warning: you are calling pdf_value on an unsupported derived class" << std::endl;
-    return 0.0;
+    hit_record rec;
+    if (!hit(r, t_min, t_max, &rec))
+      return false;
+    result->t = rec.t;
+    result->object = this;
+    result->eager_rec = rec;
+    return true;
   }
 
-  // Sample vector from origin to random point within Hittable
-  // TODO consider if this should instead just sample a random point within Hittable, and leave the origin subtraction for caller
-  virtual Vec3 random(const Vec3 & /*origin*/) const
+  /// p, normal, uv and material of a hit that intersect() found on this object, for the same ray
+  virtual void surface_attributes(const Ray & /*r*/, const surface_hit &hit, hit_record *rec) const
   {
-    std::cerr << "Warning: you are calling random on an unsupported derived class" << std::endl;
-    return Vec3(1, 0, 0);
+    *rec = hit.eager_rec;
   }
-};
-
-class Translate : public Hittable
-{
-public:
-  Translate(shared_ptr<Hittable> p, const Vec3 &displacement)
-      : ptr(p), offset(displacement) {}
-
-  virtual bool hit(
-      const Ray &r, double t_min, double t_max, hit_record *rec) const override;
-
-  virtual bool bounding_box(double time0, double time1, AABB *output_box) const override;
 
-  virtual double pdf_value(const Point3 &o, const Vec3 &v) const override;
-  virtual Vec3 random(const Point3 &o) const override;
-
-public:
-  shared_ptr<Hittable> ptr;
-  Vec3 offset;
-};
+  // Cheaper queries for when the hit's attributes aren't needed, e.g. for light sampling and shadow rays.
+  // Defaults fall back to hit(); primitives and acceleration structures override them
 
-bool Translate::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
-{
-  Ray moved_r(r.origin() - offset, r.direction(), r.time());
-  if (!ptr->hit(moved_r, t_min, t_max, rec))
-    return false;
-
-  rec->p += offset;
-  rec->set_face_normal(moved_r, rec->normal); // do we need this?
-
-  return true;
-}
-
-bool Translate::bounding_box(double time0, double time1, AABB *output_box) const
-{
-  if (!ptr->bounding_box(time0, time1, output_box))
-    return false;
-
-  *output_box = AABB(
-      output_box->min() + offset,
-      output_box->max() + offset);
-  return true;
-}
-
-double Translate::pdf_value(const Point3 &o, const Vec3 &v) const
-{
-  hit_record rec;
-  if (!this->hit(Ray(o, v), 0.001, infinity, &rec))
-    return 0;
-  return ptr->pdf_value(o - offset, v);
-}
-
-Vec3 Translate::random(const Point3 &o) const
-{
-  return ptr->random(o - offset);
-}
-
-/// Rotate about origin. TODO template on axis for x and z
-class RotateY : public Hittable
-{
-public:
-  RotateY(shared_ptr<Hittable> p, double angle_degrees);
-
-  virtual bool hit(
-      const Ray &r, double t_min, double t_max, hit_record *rec) const override;
-
-  virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
+  /// Distance to closest hit in [t_min, t_max], without computing normal, uv, material etc
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const
   {
-    *output_box = bbox;
-    return hasbox;
+    hit_record rec;
+    if (!hit(r, t_min, t_max, &rec))
+      return false;
+    *t = rec.t;
+    return true;
   }
 
-  virtual double pdf_value(const Point3 &o, const Vec3 &v) const override;
-  virtual Vec3 random(const Point3 &o) const override;
-
-public:
-  shared_ptr<Hittable> ptr;
-  double sin_theta;
-  double cos_theta;
-  bool hasbox;
-  AABB bbox;
-
-private:
-  Vec3 rotate(const Vec3 &v) const
+  /// Any-hit query: whether there is any hit in [t_min, t_max]. May stop at the first hit found
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const
   {
-    auto rot_v = v;
-    rot_v[0] = cos_theta * v[0] + sin_theta * v[2];
-    rot_v[2] = -sin_theta * v[0] + cos_theta * v[2];
-    return rot_v;
+    double t;
+    return hit_distance(r, t_min, t_max, &t);
   }
 
-  Vec3 counter_rotate(const Vec3 &v) const
+  // Methods for supporting importance sampling with HittablePDF
+  // Compute probability of sampling a given vector from random(o) method
+  virtual double pdf_value(const Point3 & /*origin*/, const Vec3 & /*v*/) const
   {
-    // "transpose rotation matrix" to reverse rotation
-    auto rot_v = v;
-    rot_v[0] = cos_theta * v[0] - sin_theta * v[2];
-    rot_v[2] = sin_theta * v[0] + cos_theta * v[2];
-    return rot_v;
+    std::cerr << "Warning: you are calling pdf_value on an unsupported derived class" << std::endl;
+    return 0.0;
   }
-};
 
-RotateY::RotateY(shared_ptr<Hittable> p, double angle_degrees) : ptr(p)
-{
-  auto radians = degrees_to_radians(angle_degrees);
-  sin_theta = sin(radians);
-  cos_theta = cos(radians);
-
-  // Get bounding box of rotated object
-  hasbox = ptr->bounding_box(0, 1, &bbox);
-
-  Point3 min(infinity, bbox.min().y(), infinity);
-  Point3 max(-infinity, bbox.max().y(), -infinity);
-
-  for (int i = 0; i <= 1; i++)
+  // Sample vector from origin to random point within Hittable
+  // TODO consider if this should instead just sample a random point within Hittable, and leave the origin subtraction for caller
+  virtual Vec3 random(const Vec3 & /*origin*/) const
   {
-    for (int k = 0; k <= 1; k++)
-    {
-      // Rotate max and min points. i, k indices are a shorthand way to switch between the two
-      auto x = (i == 0) ? bbox.max().x() : bbox.min().x();
-      auto z = (k == 0) ? bbox.max().z() : bbox.min().z();
-
-      Vec3 v(x, 0, z);
-      auto newv = rotate(v);
-
-      min[0] = fmin(min[0], newv.x());
-      max[0] = fmax(max[0], newv.x());
-      min[2] = fmin(min[2], newv.z());
-      max[2] = fmax(max[2], newv.z());
-    }
+    std::cerr << "Warning: you are calling random on an unsupported derived class" << std::endl;
+    return Vec3(1, 0, 0);
   }
+};
 
-  bbox = AABB(min, max);
-}
-
-bool RotateY::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
+/// hit() in two phases: intersect(), then attributes for the closest hit only
+inline bool deferred_hit(const Hittable &object, const Ray &r, double t_min, double t_max, hit_record *rec)
 {
-  auto origin = counter_rotate(r.origin());
-  auto direction = counter_rotate(r.direction());
-
-  Ray rotated_r(origin, direction, r.time());
-
-  if (!ptr->hit(rotated_r, t_min, t_max, rec))
+  surface_hit result;
+  if (!object.intersect(r, t_min, t_max, &result))
     return false;
-
-  rec->p = rotate(rec->p);
-  rec->set_face_normal(rotated_r, rotate(rec->normal));
-
+  result.object->surface_attributes(r, result, rec);
   return true;
 }
-
-double RotateY::pdf_value(const Point3 &o, const Vec3 &v) const
-{
-  hit_record rec;
-  if (!this->hit(Ray(o, v), 0.001, infinity, &rec))
-    return 0;
-
-  auto origin = counter_rotate(o);
-  auto direction = counter_rotate(v);
-
-  Ray rotated_r(origin, direction, 0.0);
-
-  return ptr->pdf_value(rotated_r.origin(), rotated_r.direction());
-}
-
-Vec3 RotateY::random(const Point3 &o) const
-{
-  auto origin = counter_rotate(o);
-  auto vec = ptr->random(origin);
-  auto rotated_vec = rotate(vec);
-  return rotated_vec;
-}
-
-class FlipFace : public Hittable
-{
-public:
-  FlipFace(shared_ptr<Hittable> p) : ptr(p) {}
-
-  virtual bool hit(
-      const Ray &r, double t_min, double t_max, hit_record *rec) const override
-  {
-    if (!ptr->hit(r, t_min, t_max, rec))
-      return false;
-
-    rec->front_face = !rec->front_face;
-    return true;
-  }
-
-  virtual bool bounding_box(double time0, double time1, AABB *output_box) const override
-  {
-    return ptr->bounding_box(time0, time1, output_box);
-  }
-
-  virtual double pdf_value(const Point3 &o, const Vec3 &v) const override
-  {
-    return ptr->pdf_value(o, v);
-  }
-
-  virtual Vec3 random(const Point3 &o) const override
-  {
-    return ptr->random(o);
-  }
-
-public:
-  shared_ptr<Hittable> ptr;
-};
\ No newline at end of file
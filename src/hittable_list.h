@@ -16,7 +16,16 @@ public:
   void add(std::shared_ptr<Hittable> object) { objects.push_back(object); }
 
   virtual bool hit(
-      const Ray &r, double t_min, double t_max, hit_record *rec) const override;
+      const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+  virtual bool intersect(
+      const Ray &r, double t_min, double t_max, surface_hit *result) const override;
+  virtual bool hit_distance(
+      const Ray &r, double t_min, double t_max, double *t) const override;
+  virtual bool occluded(
+      const Ray &r, double t_min, double t_max) const override;
   virtual bool bounding_box(
       double time0, double time1, AABB *output_box) const override;
 
@@ -41,25 +50,44 @@ public:
   std::vector<std::shared_ptr<Hittable> > objects;
 };
 
-bool HittableList::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
+bool HittableList::intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const
 {
-  hit_record temp_rec;
   bool hit_anything = false;
-  auto t_closest_so_far = t_max;
-
   for (const auto &object : objects)
   {
-    if (object->hit(r, t_min, t_closest_so_far, &temp_rec))
+    if (object->intersect(r, t_min, t_max, result))
     {
       hit_anything = true;
-      t_closest_so_far = temp_rec.t;
-      *rec = temp_rec;
+      t_max = result->t;
     }
   }
+  return hit_anything;
+}
 
+bool HittableList::hit_distance(const Ray &r, double t_min, double t_max, double *t) const
+{
+  bool hit_anything = false;
+  for (const auto &object : objects)
+  {
+    if (object->hit_distance(r, t_min, t_max, t))
+    {
+      hit_anything = true;
+      t_max = *t;
+    }
+  }
   return hit_anything;
 }
 
+bool HittableList::occluded(const Ray &r, double t_min, double t_max) const
+{
+  for (const auto &object : objects)
+  {
+    if (object->occluded(r, t_min, t_max))
+      return true;
+  }
+  return false;
+}
+
 bool HittableList::bounding_box(double time0, double time1, AABB *output_box) const
 {
   if (objects.empty())
@@ -0,0 +1,619 @@
+#pragma once
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "primitive_arrays.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/// BVH node in flattened, depth-first layout: an interior node's first child directly follows it in the
+/// node array, so only the second child's index needs to be stored. 32 bytes, so that two nodes share a
+/// cache line.
+struct alignas(32) LinearBVHNode
+{
+  float bounds_min[3];
+  float bounds_max[3];
+  int32_t offset;          // interior: index of second child. leaf: index of first primitive
+  uint32_t num_primitives; // 0 for interior nodes
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should fit in half a cache line");
+
+/// Node bounds at the end of the time interval, for BVHs over moving primitives
+struct LinearBVHBounds
+{
+  float bounds_min[3];
+  float bounds_max[3];
+};
+
+namespace bvh
+{
+  /// Round double bounds outwards to the nearest floats, so that float boxes always contain the original
+  inline float round_down(double x)
+  {
+    float f = static_cast<float>(x);
+    return static_cast<double>(f) > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+  }
+
+  inline float round_up(double x)
+  {
+    float f = static_cast<float>(x);
+    return static_cast<double>(f) < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+  }
+
+  /// Ray data that only needs to be computed once per traversal, instead of once per box test
+  struct RayTraversalData
+  {
+    RayTraversalData(const Ray &r)
+    {
+      for (int a = 0; a < 3; ++a)
+      {
+        origin[a] = static_cast<float>(r.origin()[a]);
+        inv_dir[a] = static_cast<float>(1.0 / r.direction()[a]);
+        dir_is_neg[a] = std::signbit(inv_dir[a]);
+      }
+    }
+
+    float origin[3];
+    float inv_dir[3];
+    int dir_is_neg[3]; // selects near/far slab planes without comparing them
+  };
+
+  /// Whether prim's bounds differ between times t0 and t1
+  inline bool is_moving(const Hittable &prim, double t0, double t1)
+  {
+    AABB box0, box1;
+    prim.bounding_box(t0, t0, &box0);
+    prim.bounding_box(t1, t1, &box1);
+    for (int a = 0; a < 3; ++a)
+    {
+      if (box0.min()[a] != box1.min()[a] || box0.max()[a] != box1.max()[a])
+        return true;
+    }
+    return false;
+  }
+
+  /// Bounds at fraction s of the time interval, for BVHs storing bounds at its start and end. Primitives
+  /// move linearly, so their bounds at any time are the interpolation of start and end bounds, and so are
+  /// contained in the interpolated node bounds
+  inline void lerp_bounds(const float start[3], const float end[3], float s, float out[3])
+  {
+    for (int a = 0; a < 3; ++a)
+      out[a] = start[a] + s * (end[a] - start[a]);
+  }
+
+  /// Ray-box slab test. On hit, t_entry is set to the distance where ray enters the box (or t_min if ray
+  /// starts inside)
+  inline bool slab_test(const float bounds_min[3], const float bounds_max[3], const RayTraversalData &ray,
+                        float t_min, float t_max, float *t_entry)
+  {
+    for (int a = 0; a < 3; ++a)
+    {
+      float t0 = (bounds_min[a] - ray.origin[a]) * ray.inv_dir[a];
+      float t1 = (bounds_max[a] - ray.origin[a]) * ray.inv_dir[a];
+      if (t0 > t1)
+        std::swap(t0, t1);
+      t1 *= slab_exit_padding<float>;
+
+      // Written so that NaNs (0 * inf, for rays in the plane of a slab) leave the interval unchanged
+      t_min = t0 > t_min ? t0 : t_min;
+      t_max = t1 < t_max ? t1 : t_max;
+      if (t_min > t_max)
+        return false;
+    }
+    *t_entry = t_min;
+    return true;
+  }
+
+  // Traversal stack holds at most one entry per level of the tree, plus one
+  static constexpr int max_stack_depth = 128;
+
+  // Below this depth, build_nodes() only makes median splits, which halve the primitives each level, so
+  // that even 2^32 primitives still fit the traversal stack
+  static constexpr int max_sah_depth = max_stack_depth - 1 - 33;
+
+  /// Appends the primitives in all leaves of node's subtree to prims
+  inline void gather_primitives(const BVHNode &node, std::vector<shared_ptr<Hittable> > *prims)
+  {
+    if (node.is_leaf())
+    {
+      prims->insert(prims->end(), node.primitives.begin(), node.primitives.end());
+      return;
+    }
+    gather_primitives(static_cast<const BVHNode &>(*node.left), prims);
+    gather_primitives(static_cast<const BVHNode &>(*node.right), prims);
+  }
+
+  /// Stack traversal of flattened nodes, visiting children nearest-first and skipping subtrees that start
+  /// beyond the closest hit so far. test_node(i, t_closest, &t_entry) tests the bounds of node i against
+  /// [t_min, t_closest]. intersect_leaf(i, &t_closest) tests the primitives of leaf node i against
+  /// [t_min, t_closest], and on a hit returns true and shrinks t_closest. With AnyHit, traversal stops
+  /// at the first hit instead of looking for the closest one
+  template <bool AnyHit, typename TestNodeFn, typename IntersectLeafFn>
+  bool traverse_nodes(const LinearBVHNode *nodes, double t_max, TestNodeFn test_node, IntersectLeafFn intersect_leaf)
+  {
+    struct StackEntry
+    {
+      int node;
+      float t_entry;
+    };
+    StackEntry stack[max_stack_depth];
+    int stack_size = 0;
+
+    float t_entry;
+    if (!test_node(0, t_max, &t_entry))
+      return false;
+    stack[stack_size++] = {0, t_entry};
+
+    bool hit_anything = false;
+    while (stack_size > 0)
+    {
+      const StackEntry entry = stack[--stack_size];
+      if (entry.t_entry > t_max) // something closer than this whole subtree was hit already
+        continue;
+
+      const LinearBVHNode &node = nodes[entry.node];
+      if (node.num_primitives > 0)
+      {
+        if (intersect_leaf(entry.node, &t_max))
+        {
+          if (AnyHit)
+            return true;
+          hit_anything = true;
+        }
+        continue;
+      }
+
+      const int first = entry.node + 1;
+      const int second = node.offset;
+      float t_first = 0, t_second = 0;
+      const bool hit_first = test_node(first, t_max, &t_first);
+      const bool hit_second = test_node(second, t_max, &t_second);
+
+      // Push farther child first, so that nearer child gets popped (visited) first
+      if (hit_first && hit_second)
+      {
+        if (t_first <= t_second)
+        {
+          stack[stack_size++] = {second, t_second};
+          stack[stack_size++] = {first, t_first};
+        }
+        else
+        {
+          stack[stack_size++] = {first, t_first};
+          stack[stack_size++] = {second, t_second};
+        }
+      }
+      else if (hit_first)
+      {
+        stack[stack_size++] = {first, t_first};
+      }
+      else if (hit_second)
+      {
+        stack[stack_size++] = {second, t_second};
+      }
+    }
+
+    return hit_anything;
+  }
+
+  /// Expected cost of a ray query against flattened nodes, same measure as BVHNode::sah_cost().
+  /// leaf_cost(leaf) is the cost of intersecting a leaf's primitives
+  template <typename LeafCostFn>
+  double sah_cost(const LinearBVHNode *nodes, size_t num_nodes, LeafCostFn leaf_cost)
+  {
+    if (num_nodes == 0)
+      return 0;
+
+    auto area = [](const LinearBVHNode &node)
+    {
+      const double dx = node.bounds_max[0] - node.bounds_min[0];
+      const double dy = node.bounds_max[1] - node.bounds_min[1];
+      const double dz = node.bounds_max[2] - node.bounds_min[2];
+      return 2 * (dx * dy + dy * dz + dz * dx);
+    };
+
+    std::vector<double> cost(num_nodes);
+    for (int i = static_cast<int>(num_nodes) - 1; i >= 0; --i)
+    {
+      const auto &node = nodes[i];
+      if (node.num_primitives > 0)
+      {
+        cost[i] = leaf_cost(node);
+        continue;
+      }
+
+      const int first = i + 1;
+      const int second = node.offset;
+      const double node_area = area(node);
+      cost[i] = node_area > 0
+                    ? traversal_cost + (area(nodes[first]) * cost[first] + area(nodes[second]) * cost[second]) / node_area
+                    : traversal_cost + cost[first] + cost[second];
+    }
+    return cost[0];
+  }
+
+  /// Build flattened SAH tree over prims[begin, end) directly, without BVHNodes, appending its nodes to
+  /// nodes. Reorders prims, and leaves refer to ranges of prims. Uses up to num_threads threads like
+  /// BVHNode: subtrees built on other threads go to their own arrays, which are appended afterwards.
+  ///
+  /// If leaves intersect pack_width primitives at once with SIMD, a leaf costs one intersection per pack
+  /// rather than per primitive, which favors full leaves. Degenerate inputs that would make the tree
+  /// deeper than max_sah_depth get median splits from there on, so leaves never exceed max_leaf_size
+  inline void build_nodes(BuildPrimitive *prims, size_t begin, size_t end, const BVHBuildOptions &opts,
+                          int num_threads, std::vector<LinearBVHNode> *nodes, int pack_width = 1, int depth = 0)
+  {
+    const AABB box = bounds(prims, begin, end);
+    const size_t count = end - begin;
+
+    Split split;
+    const bool can_split = count > 1 && depth < max_sah_depth && find_sah_split(prims, begin, end, box, opts.num_bins, &split);
+    const double leaf_cost = intersection_cost * ((count + pack_width - 1) / pack_width);
+    const bool make_leaf = count == 1 || (count <= static_cast<size_t>(opts.max_leaf_size) && (!can_split || leaf_cost <= split.cost));
+
+    const size_t node_idx = nodes->size();
+    nodes->emplace_back();
+    for (int a = 0; a < 3; ++a)
+    {
+      (*nodes)[node_idx].bounds_min[a] = round_down(box.min()[a]);
+      (*nodes)[node_idx].bounds_max[a] = round_up(box.max()[a]);
+    }
+
+    if (make_leaf)
+    {
+      (*nodes)[node_idx].offset = begin;
+      (*nodes)[node_idx].num_primitives = count;
+      return;
+    }
+    (*nodes)[node_idx].num_primitives = 0;
+
+    if (!can_split)
+      split.mid = begin + count / 2;
+
+    if (num_threads > 1 && count >= parallel_build_min_primitives)
+    {
+      const int left_threads = num_threads / 2;
+      std::vector<LinearBVHNode> left_nodes, right_nodes;
+      std::thread left_builder([&]()
+                               { build_nodes(prims, begin, split.mid, opts, left_threads, &left_nodes, pack_width, depth + 1); });
+      build_nodes(prims, split.mid, end, opts, num_threads - left_threads, &right_nodes, pack_width, depth + 1);
+      left_builder.join();
+
+      // Second child indices were relative to the subtree's own array
+      for (const auto *subtree : {&left_nodes, &right_nodes})
+      {
+        const int32_t subtree_start = nodes->size();
+        if (subtree == &right_nodes)
+          (*nodes)[node_idx].offset = subtree_start;
+        for (LinearBVHNode node : *subtree)
+        {
+          if (node.num_primitives == 0)
+            node.offset += subtree_start;
+          nodes->push_back(node);
+        }
+      }
+    }
+    else
+    {
+      build_nodes(prims, begin, split.mid, opts, 1, nodes, pack_width, depth + 1);
+      (*nodes)[node_idx].offset = nodes->size();
+      build_nodes(prims, split.mid, end, opts, 1, nodes, pack_width, depth + 1);
+    }
+  }
+}
+
+/// "Compiled" BVH: BVHNode tree flattened into one contiguous array, traversed with an explicit stack
+/// instead of recursive virtual calls. Children are visited nearest-first, and subtrees that start
+/// beyond the closest hit found so far are skipped when popped off the stack.
+///
+/// Nested BVHNodes found in the leaves (e.g. meshes) are compiled into their own LinearBVH. Leaves
+/// intersect built-in primitive types from typed arrays (see PrimitiveArrays), without virtual calls.
+///
+/// When primitives move but the set of primitives stays the same (e.g. particles between simulation
+/// frames), refit() updates the bounds in place instead of building a new tree. It also copies the
+/// primitives into the typed arrays again, which changes to primitives aren't seen in until then.
+///
+/// For motion blur: if primitives move during [time0, time1] (the camera's shutter interval), nodes get
+/// bounds at time0 and time1, and traversal interpolates them at each ray's time. Rays then only visit
+/// nodes where primitives are at that time, instead of wherever they are during the whole interval.
+class LinearBVH : public Hittable
+{
+public:
+  LinearBVH() = default;
+
+  /// Compile given tree, built over time interval [time0, time1]
+  explicit LinearBVH(const BVHNode &root, double time0 = 0, double time1 = 1) : time0(time0), time1(time1)
+  {
+    root.bounding_box(time0, time1, &box);
+    flatten(root);
+    typed_primitives.assign(primitives);
+    if (has_moving_primitives())
+      fit_motion_bounds();
+    built_sah_cost = sah_cost();
+  }
+
+  /// Build BVHNode tree over objects, then compile it
+  LinearBVH(const HittableList &list, double time0, double time1, const BVHBuildOptions &opts = BVHBuildOptions())
+      : LinearBVH(BVHNode(list, time0, time1, opts), time0, time1)
+  {
+    build_opts = opts;
+  }
+
+  virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    return traverse<false>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                           {
+                             if (!prim.intersect(r, t_min, *t_closest, result))
+                               return false;
+                             *t_closest = result->t;
+                             return true; });
+  }
+
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    return traverse<false>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                           {
+                             if (!prim.hit_distance(r, t_min, *t_closest, t))
+                               return false;
+                             *t_closest = *t;
+                             return true; });
+  }
+
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override
+  {
+    return traverse<true>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                          { return prim.occluded(r, t_min, *t_closest); });
+  }
+
+  virtual bool bounding_box(double time_a, double time_b, AABB *output_box) const override;
+
+  /// Recompute all node bounds bottom-up from the primitives' current bounds, keeping the tree topology.
+  /// Typed copies of the primitives are updated too. O(n). Nested LinearBVHs among the primitives need to
+  /// be refit first
+  void refit();
+
+  /// Expected cost of a ray query against this tree, same measure as BVHNode::sah_cost()
+  double sah_cost() const;
+
+  /// Refit, and if that made the tree more than max_cost_ratio times as expensive as it was right after
+  /// it was built, rebuild it from scratch over the same primitives. Returns true if the tree was rebuilt
+  bool refit_or_rebuild(double max_cost_ratio = 1.5);
+
+public:
+  std::vector<LinearBVHNode> nodes;
+  std::vector<shared_ptr<Hittable> > primitives; // in leaf order, each leaf sorted by type
+  PrimitiveArrays typed_primitives;              // copies of primitives that leaves are intersected with
+  AABB box;
+
+  // Bounds at time1 when primitives move, with nodes holding bounds at time0. Empty otherwise
+  std::vector<LinearBVHBounds> end_bounds;
+
+  // Time interval that bounds are for
+  double time0 = 0;
+  double time1 = 1;
+
+  // Used by refit_or_rebuild()
+  BVHBuildOptions build_opts;
+  double built_sah_cost = 0;
+
+private:
+  int flatten(const BVHNode &node, int depth = 0);
+
+  bool has_moving_primitives() const;
+
+  /// Set bounds[i] to the bounds of node i's primitives over [time_a, time_b], bottom-up. Bounds is
+  /// LinearBVHNode or LinearBVHBounds
+  template <typename Bounds>
+  void fit_bounds(double time_a, double time_b, Bounds *bounds) const;
+
+  /// Node bounds at time0 and end_bounds at time1
+  void fit_motion_bounds();
+
+  /// Traversal shared by hit(), hit_distance() and occluded(). intersect(prim, &t_closest) tests one
+  /// primitive, as its concrete type, against [t_min, t_closest], and on a hit returns true and shrinks
+  /// t_closest. With AnyHit, traversal stops at the first hit instead of looking for the closest one
+  template <bool AnyHit, typename IntersectFn>
+  bool traverse(const Ray &r, double t_min, double t_max, IntersectFn intersect) const;
+};
+
+int LinearBVH::flatten(const BVHNode &node, int depth)
+{
+  const int node_idx = nodes.size();
+  nodes.emplace_back();
+  for (int a = 0; a < 3; ++a)
+  {
+    nodes[node_idx].bounds_min[a] = bvh::round_down(node.box.min()[a]);
+    nodes[node_idx].bounds_max[a] = bvh::round_up(node.box.max()[a]);
+  }
+
+  // A subtree too deep for the traversal stack becomes one leaf with all of its primitives
+  const bool too_deep = depth >= bvh::max_stack_depth - 1;
+  if (node.is_leaf() || too_deep)
+  {
+    std::vector<shared_ptr<Hittable> > subtree_primitives;
+    if (too_deep && !node.is_leaf())
+      bvh::gather_primitives(node, &subtree_primitives);
+    const auto &leaf_primitives = node.is_leaf() ? node.primitives : subtree_primitives;
+
+    nodes[node_idx].offset = primitives.size();
+    nodes[node_idx].num_primitives = leaf_primitives.size();
+    for (const auto &prim : leaf_primitives)
+    {
+      auto nested_bvh = std::dynamic_pointer_cast<BVHNode>(prim);
+      primitives.push_back(nested_bvh ? make_shared<LinearBVH>(*nested_bvh, time0, time1) : prim);
+    }
+    PrimitiveArrays::sort_leaf(primitives, nodes[node_idx].offset, primitives.size());
+    return node_idx;
+  }
+
+  auto left = std::dynamic_pointer_cast<BVHNode>(node.left);
+  auto right = std::dynamic_pointer_cast<BVHNode>(node.right);
+  assert(left && right); // builder only puts BVHNodes in interior nodes
+
+  flatten(*left, depth + 1);
+  const int right_idx = flatten(*right, depth + 1);
+  nodes[node_idx].offset = right_idx;
+  nodes[node_idx].num_primitives = 0;
+  return node_idx;
+}
+
+bool LinearBVH::has_moving_primitives() const
+{
+  for (const auto &prim : primitives)
+  {
+    if (bvh::is_moving(*prim, time0, time1))
+      return true;
+  }
+  return false;
+}
+
+template <typename Bounds>
+void LinearBVH::fit_bounds(double time_a, double time_b, Bounds *bounds) const
+{
+  // Children are always stored after their parent, so going backwards visits children first
+  for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i)
+  {
+    const auto &node = nodes[i];
+    if (node.num_primitives > 0)
+    {
+      AABB node_box;
+      for (uint32_t k = 0; k < node.num_primitives; ++k)
+      {
+        AABB prim_box;
+        primitives[node.offset + k]->bounding_box(time_a, time_b, &prim_box);
+        node_box = k == 0 ? prim_box : surrounding_box(node_box, prim_box);
+      }
+      for (int a = 0; a < 3; ++a)
+      {
+        bounds[i].bounds_min[a] = bvh::round_down(node_box.min()[a]);
+        bounds[i].bounds_max[a] = bvh::round_up(node_box.max()[a]);
+      }
+    }
+    else
+    {
+      const auto &first = bounds[i + 1];
+      const auto &second = bounds[node.offset];
+      for (int a = 0; a < 3; ++a)
+      {
+        bounds[i].bounds_min[a] = std::min(first.bounds_min[a], second.bounds_min[a]);
+        bounds[i].bounds_max[a] = std::max(first.bounds_max[a], second.bounds_max[a]);
+      }
+    }
+  }
+}
+
+void LinearBVH::fit_motion_bounds()
+{
+  end_bounds.resize(nodes.size());
+  fit_bounds(time0, time0, nodes.data());
+  fit_bounds(time1, time1, end_bounds.data());
+}
+
+void LinearBVH::refit()
+{
+  if (nodes.empty())
+    return;
+
+  typed_primitives.assign(primitives);
+  end_bounds.clear();
+  if (has_moving_primitives())
+    fit_motion_bounds();
+  else
+    fit_bounds(time0, time1, nodes.data());
+
+  box = AABB(Point3(nodes[0].bounds_min[0], nodes[0].bounds_min[1], nodes[0].bounds_min[2]),
+             Point3(nodes[0].bounds_max[0], nodes[0].bounds_max[1], nodes[0].bounds_max[2]));
+  bounding_box(time0, time1, &box); // covers whole interval if primitives move
+}
+
+bool LinearBVH::bounding_box(double time_a, double time_b, AABB *output_box) const
+{
+  if (end_bounds.empty() || nodes.empty())
+  {
+    *output_box = box;
+    return true;
+  }
+
+  // Union of interpolated root bounds at both times
+  float box_min[3], box_max[3];
+  for (double time : {time_a, time_b})
+  {
+    const float s = static_cast<float>((time - time0) / (time1 - time0));
+    float lerp_min[3], lerp_max[3];
+    bvh::lerp_bounds(nodes[0].bounds_min, end_bounds[0].bounds_min, s, lerp_min);
+    bvh::lerp_bounds(nodes[0].bounds_max, end_bounds[0].bounds_max, s, lerp_max);
+    for (int a = 0; a < 3; ++a)
+    {
+      box_min[a] = time == time_a ? lerp_min[a] : std::min(box_min[a], lerp_min[a]);
+      box_max[a] = time == time_a ? lerp_max[a] : std::max(box_max[a], lerp_max[a]);
+    }
+  }
+  *output_box = AABB(Point3(box_min[0], box_min[1], box_min[2]), Point3(box_max[0], box_max[1], box_max[2]));
+  return true;
+}
+
+double LinearBVH::sah_cost() const
+{
+  return bvh::sah_cost(nodes.data(), nodes.size(), [&](const LinearBVHNode &leaf)
+                       {
+                         double cost = 0;
+                         for (uint32_t k = 0; k < leaf.num_primitives; ++k)
+                         {
+                           auto nested_bvh = dynamic_cast<const LinearBVH *>(primitives[leaf.offset + k].get());
+                           cost += nested_bvh ? nested_bvh->sah_cost() : bvh::intersection_cost;
+                         }
+                         return cost; });
+}
+
+bool LinearBVH::refit_or_rebuild(double max_cost_ratio)
+{
+  refit();
+  if (sah_cost() <= max_cost_ratio * built_sah_cost)
+    return false;
+
+  HittableList list;
+  list.objects = primitives;
+  *this = LinearBVH(list, time0, time1, build_opts);
+  return true;
+}
+
+template <bool AnyHit, typename IntersectFn>
+bool LinearBVH::traverse(const Ray &r, double t_min, double t_max, IntersectFn intersect) const
+{
+  if (nodes.empty())
+    return false;
+
+  const bvh::RayTraversalData ray(r);
+
+  // Node bounds at ray time, for moving primitives
+  const bool motion = !end_bounds.empty();
+  const float s = motion ? static_cast<float>((r.time() - time0) / (time1 - time0)) : 0;
+  auto test_node = [&](int i, double t_closest, float *t_entry)
+  {
+    if (!motion)
+      return bvh::slab_test(nodes[i].bounds_min, nodes[i].bounds_max, ray, t_min, t_closest, t_entry);
+
+    float bounds_min[3], bounds_max[3];
+    bvh::lerp_bounds(nodes[i].bounds_min, end_bounds[i].bounds_min, s, bounds_min);
+    bvh::lerp_bounds(nodes[i].bounds_max, end_bounds[i].bounds_max, s, bounds_max);
+    return bvh::slab_test(bounds_min, bounds_max, ray, t_min, t_closest, t_entry);
+  };
+
+  return bvh::traverse_nodes<AnyHit>(nodes.data(), t_max, test_node, [&](int leaf, double *t_closest)
+                                     { return typed_primitives.for_each<AnyHit>(nodes[leaf].offset, nodes[leaf].num_primitives,
+                                                                                [&](const auto &prim)
+                                                                                { return intersect(prim, t_closest); }); });
+}
@@ -5,6 +5,10 @@
 #include "pdf.h"
 #include "texture.h"
 
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+
 struct hit_record;
 
 struct scatter_record
@@ -12,13 +16,49 @@ struct scatter_record
   Ray specular_ray;
   bool is_specular;
   Color attenuation;
-  shared_ptr<PDF> pdf_ptr;
+
+  /// Scatter PDF for non-specular scattering, held by value so that scattering doesn't allocate. New
+  /// kinds of scatter PDF get added as alternatives here
+  std::variant<std::monostate, CosinePDF> pdf;
+
+  /// The scatter PDF, or nullptr if there is none
+  const PDF *pdf_ptr() const
+  {
+    return std::visit([](const auto &alternative) -> const PDF *
+                      {
+                        if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, std::monostate>)
+                          return nullptr;
+                        else
+                          return &alternative; },
+                      pdf);
+  }
 };
 
+/// Built-in materials. Each one is a final class that sets its type, so that material::visit() can
+/// switch on the type and call it directly instead of through the vtable. Other subclasses of Material
+/// are "other", and get called virtually
+enum class MaterialType : uint8_t
+{
+  lambertian,
+  metal,
+  dielectric,
+  diffuse_light,
+  isotropic,
+  other
+};
+
+class Lambertian;
+class Metal;
+class Dielectric;
+class DiffuseLight;
+class Isotropic;
+
 /// Recall: Color = A * color(direction) * pdf_scatter(direction) / pdf_sampling(direction)
 class Material
 {
 public:
+  Material() : type(MaterialType::other) {}
+
   /**
    * @brief Compute scatter on material
    *
@@ -44,31 +84,45 @@ public:
   }
 
   virtual ~Material() = default;
+
+public:
+  const MaterialType type;
+
+private:
+  // Only the built-in materials may claim a built-in type, since material::visit() casts to the class
+  // that the type names
+  explicit Material(MaterialType type) : type(type) {}
+
+  friend class Lambertian;
+  friend class Metal;
+  friend class Dielectric;
+  friend class DiffuseLight;
+  friend class Isotropic;
 };
 
-class Lambertian : public Material
+class Lambertian final : public Material
 {
 public:
-  Lambertian(const Color &a) : albedo(make_shared<SolidColor>(a)) {}
-  Lambertian(shared_ptr<Texture> a) : albedo(a) {}
+  Lambertian(const Color &a) : Material(MaterialType::lambertian), albedo(a) {}
+  Lambertian(shared_ptr<Texture> a) : Material(MaterialType::lambertian), albedo(a) {}
 
   virtual bool scatter(
       const Ray & /*r_in*/, const hit_record &rec, scatter_record *srec) const override
   {
     srec->is_specular = false;
-    srec->attenuation = albedo->value(rec.u, rec.v, rec.p);
-    srec->pdf_ptr = make_shared<CosinePDF>(rec.normal);
+    srec->attenuation = albedo.value(rec.u, rec.v, rec.p);
+    srec->pdf = CosinePDF(rec.normal);
     return true;
   }
 
 public:
-  shared_ptr<Texture> albedo;
+  TextureGraph albedo;
 };
 
-class Metal : public Material
+class Metal final : public Material
 {
 public:
-  Metal(const Color &a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+  Metal(const Color &a, double f) : Material(MaterialType::metal), albedo(a), fuzz(f < 1 ? f : 1) {}
 
   virtual bool scatter(
       const Ray &r_in, const hit_record &rec, scatter_record *srec) const override
@@ -77,7 +131,7 @@ public:
     srec->specular_ray = Ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
     srec->attenuation = albedo;
     srec->is_specular = true; // not strictly true if fuzz is non-zero
-    srec->pdf_ptr = nullptr;
+    srec->pdf = std::monostate();
     return dot(srec->specular_ray.direction(), rec.normal) > 0;
   }
 
@@ -86,16 +140,17 @@ public:
   double fuzz;
 };
 
-class Dielectric : public Material
+class Dielectric final : public Material
 {
 public:
-  Dielectric(double index_of_refraction, const Color &c = Color(1, 1, 1)) : ir(index_of_refraction), albedo(c) {}
+  Dielectric(double index_of_refraction, const Color &c = Color(1, 1, 1))
+      : Material(MaterialType::dielectric), ir(index_of_refraction), albedo(c) {}
 
   virtual bool scatter(
       const Ray &r_in, const hit_record &rec, scatter_record *srec) const override
   {
     srec->is_specular = true;
-    srec->pdf_ptr = nullptr;
+    srec->pdf = std::monostate();
     srec->attenuation = albedo;
 
     double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
@@ -130,11 +185,11 @@ private:
   }
 };
 
-class DiffuseLight : public Material
+class DiffuseLight final : public Material
 {
 public:
-  DiffuseLight(shared_ptr<Texture> a) : emit(a) {}
-  DiffuseLight(const Color &c) : emit(make_shared<SolidColor>(c)) {}
+  DiffuseLight(shared_ptr<Texture> a) : Material(MaterialType::diffuse_light), emit(a) {}
+  DiffuseLight(const Color &c) : Material(MaterialType::diffuse_light), emit(c) {}
 
   virtual bool scatter(
       const Ray & /*r_in*/, const hit_record & /*rec*/, scatter_record * /*srec*/) const override
@@ -146,31 +201,56 @@ public:
   virtual Color emitted(const Ray & /*r_in*/, const hit_record &rec, double u, double v, const Point3 &p) const override
   {
     if (rec.front_face)
-      return emit->value(u, v, p);
+      return emit.value(u, v, p);
     else
       return Color(0, 0, 0);
   }
 
 public:
-  shared_ptr<Texture> emit;
+  TextureGraph emit;
 };
 
-class Isotropic : public Material
+class Isotropic final : public Material
 {
 public:
-  Isotropic(const Color &c) : albedo(make_shared<SolidColor>(c)) {}
-  Isotropic(shared_ptr<Texture> a) : albedo(a) {}
+  Isotropic(const Color &c) : Material(MaterialType::isotropic), albedo(c) {}
+  Isotropic(shared_ptr<Texture> a) : Material(MaterialType::isotropic), albedo(a) {}
 
   virtual bool scatter(
       const Ray &r_in, const hit_record &rec, scatter_record *srec) const override
   {
     srec->is_specular = true; // TODO add spherical uniform PDF here
-    srec->pdf_ptr = nullptr;
-    srec->attenuation = albedo->value(rec.u, rec.v, rec.p);
+    srec->pdf = std::monostate();
+    srec->attenuation = albedo.value(rec.u, rec.v, rec.p);
     srec->specular_ray = Ray(rec.p, random_in_unit_sphere(), r_in.time());
     return true;
   }
 
 public:
-  shared_ptr<Texture> albedo;
-};
\ No newline at end of file
+  TextureGraph albedo;
+};
+
+namespace material
+{
+  /// Calls f with m as its concrete class, e.g. f(static_cast<const Metal &>(m)), so that calls to m in
+  /// f are direct (and can be inlined) for built-in materials. f gets const Material & for other ones
+  template <class F>
+  decltype(auto) visit(const Material &m, F &&f)
+  {
+    switch (m.type)
+    {
+    case MaterialType::lambertian:
+      return f(static_cast<const Lambertian &>(m));
+    case MaterialType::metal:
+      return f(static_cast<const Metal &>(m));
+    case MaterialType::dielectric:
+      return f(static_cast<const Dielectric &>(m));
+    case MaterialType::diffuse_light:
+      return f(static_cast<const DiffuseLight &>(m));
+    case MaterialType::isotropic:
+      return f(static_cast<const Isotropic &>(m));
+    default:
+      return f(m);
+    }
+  }
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "parallel.h"
+#include "triangle.h"
+#include "triangle_pack.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Indexed triangle mesh: shared vertices, and three vertex indices per triangle
+struct MeshData
+{
+  std::vector<float> vertices;   // x, y, z per vertex
+  std::vector<uint32_t> indices; // 3 per triangle
+};
+
+/// Triangle mesh as one Hittable: float vertex positions in one shared buffer, an index triple per
+/// triangle, one material for the whole mesh, and its own flattened BVH whose leaves are ranges of
+/// triangles. That's 12 bytes per vertex, 12 per triangle and about 32 per triangle for the BVH,
+/// instead of a Triangle object (~200 bytes plus shared_ptr control block) per face.
+///
+/// Leaves are intersected a TrianglePack at a time: the leaf's triangles in SoA layout, tested with one
+/// SIMD kernel (SSE in float, AVX in double). Packs are built from the buffers on construction, and add
+/// about 36 bytes per triangle. Triangles are intersected in double precision by default, or in float
+/// with single_precision.
+///
+/// Index triples are stored in BVH leaf order. Buffers either belong to the mesh or live elsewhere
+/// (e.g. in a memory-mapped cache file, see mesh_cache), in which case they are used in place.
+class TriangleMesh : public Hittable
+{
+public:
+  /// Build BVH over all triangles of mesh. Reorders mesh.indices into leaf order
+  TriangleMesh(MeshData mesh, shared_ptr<Material> m, const BVHBuildOptions &opts = BVHBuildOptions());
+
+  /// Use buffers that live elsewhere without copying them. storage keeps that memory alive. Index triples
+  /// must be in the nodes' leaf order
+  TriangleMesh(const float *vertex_data, size_t num_vertices, const uint32_t *index_data, size_t num_triangles,
+               const LinearBVHNode *node_data, size_t num_nodes, const AABB &bounds, shared_ptr<Material> m,
+               shared_ptr<const void> storage)
+      : vertices(vertex_data), indices(index_data), nodes(node_data), num_vertices(num_vertices),
+        num_triangles(num_triangles), num_nodes(num_nodes), box(bounds), mat_ptr(m), storage(std::move(storage))
+  {
+    build_packs();
+  }
+
+  // Buffer pointers may point into the mesh's own storage
+  TriangleMesh(const TriangleMesh &) = delete;
+  TriangleMesh &operator=(const TriangleMesh &) = delete;
+
+  virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+
+  /// Finds the closest triangle and its barycentrics. The normal is only computed for the closest hit
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    uint32_t tri;
+    double t, u, v;
+    const bool hit_anything = single_precision ? query<false, float>(r, t_min, t_max, &tri, &t, &u, &v)
+                                               : query<false, double>(r, t_min, t_max, &tri, &t, &u, &v);
+    if (!hit_anything)
+      return false;
+    result->t = t;
+    result->object = this;
+    result->prim = tri;
+    result->u = u;
+    result->v = v;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override;
+
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    uint32_t tri;
+    double u, v;
+    return single_precision ? query<false, float>(r, t_min, t_max, &tri, t, &u, &v)
+                            : query<false, double>(r, t_min, t_max, &tri, t, &u, &v);
+  }
+
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override
+  {
+    uint32_t tri;
+    double t, u, v;
+    return single_precision ? query<true, float>(r, t_min, t_max, &tri, &t, &u, &v)
+                            : query<true, double>(r, t_min, t_max, &tri, &t, &u, &v);
+  }
+
+  virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
+  {
+    *output_box = box;
+    return num_triangles > 0;
+  }
+
+  template <typename Scalar = double>
+  Vec3T<Scalar> vertex(uint32_t tri, int k) const
+  {
+    const float *p = vertices + 3 * size_t(indices[3 * tri + k]);
+    return Vec3T<Scalar>(p[0], p[1], p[2]);
+  }
+
+public:
+  const float *vertices;   // x, y, z per vertex
+  const uint32_t *indices; // 3 per triangle, in leaf order
+  const LinearBVHNode *nodes;
+  size_t num_vertices;
+  size_t num_triangles;
+  size_t num_nodes;
+  AABB box;
+  shared_ptr<Material> mat_ptr;
+  bool single_precision = false;
+
+  static constexpr int pack_width = 4;
+
+private:
+  // Buffers when owned by the mesh, otherwise memory that the buffers point into
+  MeshData mesh_data;
+  std::vector<LinearBVHNode> node_data;
+  shared_ptr<const void> storage;
+
+  // Triangles of each leaf, in packs of pack_width. Leaf node i's packs start at leaf_packs[i]
+  std::vector<TrianglePack<pack_width> > packs;
+  std::vector<uint32_t> leaf_packs;
+
+  void build_packs();
+
+  /// Closest hit (or with AnyHit, any hit) in [t_min, t_max]: triangle index, distance and barycentrics
+  template <bool AnyHit, typename Scalar>
+  bool query(const Ray &r, double t_min, double t_max, uint32_t *hit_tri, double *t, double *u, double *v) const
+  {
+    const RayT<Scalar> ray(r);
+    return traverse<AnyHit>(r, t_min, t_max, [&](int leaf, double *t_closest)
+                            {
+                              bool hit_anything = false;
+                              const uint32_t num_packs = (nodes[leaf].num_primitives + pack_width - 1) / pack_width;
+                              for (uint32_t p = 0; p < num_packs; ++p)
+                              {
+                                Scalar t_lane[pack_width], u_lane[pack_width], v_lane[pack_width];
+                                int mask = triangle_pack::intersect(packs[leaf_packs[leaf] + p], ray, Scalar(t_min), Scalar(*t_closest),
+                                                                    t_lane, u_lane, v_lane);
+                                while (mask)
+                                {
+                                  const int lane = __builtin_ctz(mask);
+                                  mask &= mask - 1;
+
+                                  // Rounding t_min, t_closest to float can widen the interval slightly
+                                  if (t_lane[lane] < t_min || t_lane[lane] > *t_closest)
+                                    continue;
+                                  *t_closest = *t = t_lane[lane];
+                                  *u = u_lane[lane];
+                                  *v = v_lane[lane];
+                                  *hit_tri = nodes[leaf].offset + p * pack_width + lane;
+                                  if (AnyHit)
+                                    return true;
+                                  hit_anything = true;
+                                }
+                              }
+                              return hit_anything; });
+  }
+
+  template <bool AnyHit, typename IntersectLeafFn>
+  bool traverse(const Ray &r, double t_min, double t_max, IntersectLeafFn intersect_leaf) const
+  {
+    if (num_nodes == 0)
+      return false;
+
+    const bvh::RayTraversalData ray(r);
+    auto test_node = [&](int i, double t_closest, float *t_entry)
+    { return bvh::slab_test(nodes[i].bounds_min, nodes[i].bounds_max, ray, t_min, t_closest, t_entry); };
+    return bvh::traverse_nodes<AnyHit>(nodes, t_max, test_node, intersect_leaf);
+  }
+};
+
+TriangleMesh::TriangleMesh(MeshData mesh, shared_ptr<Material> m, const BVHBuildOptions &opts)
+    : num_triangles(mesh.indices.size() / 3), mat_ptr(m), mesh_data(std::move(mesh))
+{
+  num_vertices = mesh_data.vertices.size() / 3;
+  vertices = mesh_data.vertices.data();
+  indices = mesh_data.indices.data();
+
+  // Same padded bounds as Triangle, so that flat triangles have some depth
+  std::vector<bvh::BuildPrimitive> prims(num_triangles);
+  parallel_for(static_cast<int>(num_triangles), opts.num_threads, [&](int begin, int end)
+               {
+                 const Vec3 eps(1e-6, 1e-6, 1e-6);
+                 for (int tri = begin; tri < end; ++tri)
+                 {
+                   Point3 lb(infinity, infinity, infinity), ub(-infinity, -infinity, -infinity);
+                   for (int k = 0; k < 3; ++k)
+                   {
+                     const Point3 p = vertex(tri, k);
+                     for (int a = 0; a < 3; ++a)
+                     {
+                       lb[a] = std::min(lb[a], p[a]);
+                       ub[a] = std::max(ub[a], p[a]);
+                     }
+                   }
+                   prims[tri].box = AABB(lb - eps, ub + eps);
+                   prims[tri].centroid = prims[tri].box.centroid();
+                   prims[tri].index = tri;
+                 }
+               },
+               bvh::parallel_build_min_primitives);
+
+  if (num_triangles > 0)
+  {
+    box = bvh::bounds(prims.data(), 0, num_triangles);
+    bvh::build_nodes(prims.data(), 0, num_triangles, opts, opts.num_threads, &node_data, pack_width);
+  }
+  nodes = node_data.data();
+  num_nodes = node_data.size();
+
+  std::vector<uint32_t> leaf_order_indices(mesh_data.indices.size());
+  for (size_t i = 0; i < num_triangles; ++i)
+    for (int k = 0; k < 3; ++k)
+      leaf_order_indices[3 * i + k] = mesh_data.indices[3 * prims[i].index + k];
+  mesh_data.indices = std::move(leaf_order_indices);
+  indices = mesh_data.indices.data();
+
+  build_packs();
+}
+
+void TriangleMesh::build_packs()
+{
+  leaf_packs.assign(num_nodes, 0);
+  for (size_t i = 0; i < num_nodes; ++i)
+  {
+    if (nodes[i].num_primitives == 0)
+      continue;
+
+    leaf_packs[i] = packs.size();
+    for (uint32_t k = 0; k < nodes[i].num_primitives; ++k)
+    {
+      const int lane = k % pack_width;
+      if (lane == 0)
+        packs.push_back(TrianglePack<pack_width>()); // zeros: unused lanes are degenerate
+
+      const uint32_t tri = nodes[i].offset + k;
+      float(*pack_vertices[3])[pack_width] = {packs.back().v0, packs.back().v1, packs.back().v2};
+      for (int corner = 0; corner < 3; ++corner)
+      {
+        const float *p = vertices + 3 * size_t(indices[3 * tri + corner]);
+        for (int a = 0; a < 3; ++a)
+          pack_vertices[corner][a][lane] = p[a];
+      }
+    }
+  }
+}
+
+void TriangleMesh::surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const
+{
+  const Point3 v0 = vertex(hit.prim, 0);
+  rec->t = hit.t;
+  rec->u = hit.u;
+  rec->v = hit.v;
+  rec->p = r.at(rec->t);
+  rec->set_face_normal(r, unit_vector(cross(vertex(hit.prim, 1) - v0, vertex(hit.prim, 2) - v0)));
+  rec->mat_ptr = mat_ptr.get();
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include "bvh.h"
+#include "common.h"
+#include "linear_bvh.h"
+#include "mesh.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// Read-only memory mapping of a whole file. Pages come from the OS page cache, so all processes that map
+/// the same file share them
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string &path)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+      void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapping != MAP_FAILED)
+      {
+        data = static_cast<const char *>(mapping);
+        size = st.st_size;
+      }
+    }
+    close(fd); // mapping stays valid
+  }
+
+  ~MappedFile()
+  {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+/// Binary cache of a TriangleMesh and its BVH, so that later runs can skip parsing and BVH construction.
+/// Layout: header, then vertices (float), triangle indices (uint32, in BVH leaf order) and LinearBVHNodes,
+/// each array starting at a 32 byte aligned offset. Sections are used directly from the mapped file.
+///
+/// The cache is ignored (and rewritten by import_triangle_mesh()) if the format version, the source file's
+/// size or modification time, or the BVH build options don't match, or if its contents are inconsistent
+/// (sections out of bounds, indices past the vertices, nodes pointing outside the tree).
+///
+/// Caching is off unless directory is set. Cache files are kept there, not next to the meshes.
+namespace mesh_cache
+{
+  inline std::string directory;
+
+  static constexpr char magic[8] = {'B', 'B', 'L', 'M', 'E', 'S', 'H', '\0'};
+  static constexpr uint32_t version = 2; // 2: mesh BVHs built for triangle packs
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size; // sizeof(LinearBVHNode)
+
+    // Source file and build options the cache was made from
+    uint64_t source_size;
+    int64_t source_mtime;
+    int32_t split_method;
+    int32_t max_leaf_size;
+    int32_t num_bins;
+    int32_t padding;
+
+    uint64_t num_vertices;
+    uint64_t num_triangles;
+    uint64_t num_nodes;
+
+    // Byte offsets of the arrays from start of file
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t nodes_offset;
+
+    double box_min[3];
+    double box_max[3];
+  };
+
+  /// Cache contents, pointing into the mapped file. Keep file alive while using the pointers
+  struct View
+  {
+    shared_ptr<MappedFile> file;
+    const Header *header;
+    const float *vertices;
+    const uint32_t *indices;
+    const LinearBVHNode *nodes;
+  };
+
+  inline uint64_t align_offset(uint64_t offset)
+  {
+    return (offset + 31) & ~uint64_t(31);
+  }
+
+  /// Cache file for source_file in directory: named after the source file, plus a hash of its path so
+  /// that meshes with the same name in different places don't share one
+  inline std::string cache_file(const std::string &source_file)
+  {
+    const size_t name_start = source_file.find_last_of('/') + 1; // 0 if no '/'
+    char path_hash[17];
+    std::snprintf(path_hash, sizeof(path_hash), "%016llx",
+                  static_cast<unsigned long long>(std::hash<std::string>()(source_file)));
+    return directory + "/" + source_file.substr(name_start) + "." + path_hash + ".bvhcache";
+  }
+
+  /// Whether count elements of element_size bytes, starting at an aligned offset, fit before end
+  inline bool section_fits(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t end)
+  {
+    return offset % 32 == 0 && offset <= end && count <= (end - offset) / element_size;
+  }
+
+  /// Whether indices only refer to existing vertices, and nodes form a tree that traversal can't leave:
+  /// interior nodes' children come after them and within the node array, leaves' triangle ranges are
+  /// within the triangles, and the tree isn't deeper than the traversal stack
+  inline bool valid_contents(const View &view)
+  {
+    const Header &header = *view.header;
+    for (uint64_t i = 0; i < 3 * header.num_triangles; ++i)
+    {
+      if (view.indices[i] >= header.num_vertices)
+        return false;
+    }
+
+    std::vector<int> depth(header.num_nodes, 0);
+    for (uint64_t i = 0; i < header.num_nodes; ++i)
+    {
+      const LinearBVHNode &node = view.nodes[i];
+      if (node.offset < 0 || depth[i] >= bvh::max_stack_depth - 1)
+        return false;
+      const uint64_t offset = static_cast<uint64_t>(node.offset);
+      if (node.num_primitives > 0)
+      {
+        if (offset + node.num_primitives > header.num_triangles)
+          return false;
+        continue;
+      }
+      if (offset <= i + 1 || offset >= header.num_nodes)
+        return false;
+      depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+      depth[offset] = std::max(depth[offset], depth[i] + 1);
+    }
+    return true;
+  }
+
+  /// Header fields that identify source file and build options; the rest is filled in by save()
+  inline bool describe_source(const std::string &source_file, const BVHBuildOptions &opts, Header *header)
+  {
+    struct stat st;
+    if (stat(source_file.c_str(), &st) != 0)
+      return false;
+
+    std::memset(header, 0, sizeof(Header));
+    std::memcpy(header->magic, magic, sizeof(magic));
+    header->version = version;
+    header->node_size = sizeof(LinearBVHNode);
+    header->source_size = st.st_size;
+    header->source_mtime = st.st_mtime;
+    header->split_method = static_cast<int32_t>(opts.split_method);
+    header->max_leaf_size = opts.max_leaf_size;
+    header->num_bins = opts.num_bins;
+    return true;
+  }
+
+  /// Map cache file if it exists and matches source file and build options
+  inline bool load(const std::string &cache_file, const std::string &source_file, const BVHBuildOptions &opts, View *view)
+  {
+    Header expected;
+    if (!describe_source(source_file, opts, &expected))
+      return false;
+
+    auto file = make_shared<MappedFile>(cache_file);
+    if (!file->data || file->size < sizeof(Header))
+      return false;
+
+    const Header *header = reinterpret_cast<const Header *>(file->data);
+    if (std::memcmp(header, &expected, offsetof(Header, num_vertices)) != 0)
+      return false;
+
+    // Sections in order, each within the next one's start (the file's end for the nodes)
+    if (header->num_nodes == 0 || header->vertices_offset < sizeof(Header) ||
+        !section_fits(header->vertices_offset, header->num_vertices, 3 * sizeof(float), header->indices_offset) ||
+        !section_fits(header->indices_offset, header->num_triangles, 3 * sizeof(uint32_t), header->nodes_offset) ||
+        !section_fits(header->nodes_offset, header->num_nodes, sizeof(LinearBVHNode), file->size))
+      return false;
+
+    View contents;
+    contents.header = header;
+    contents.vertices = reinterpret_cast<const float *>(file->data + header->vertices_offset);
+    contents.indices = reinterpret_cast<const uint32_t *>(file->data + header->indices_offset);
+    contents.nodes = reinterpret_cast<const LinearBVHNode *>(file->data + header->nodes_offset);
+    contents.file = file;
+    if (!valid_contents(contents))
+      return false;
+
+    *view = contents;
+    return true;
+  }
+
+  /// Write cache for mesh and its BVH. Writes to a temporary file that is renamed into place, so that
+  /// concurrent readers never see a partially written cache
+  inline bool save(const std::string &cache_file, const std::string &source_file, const BVHBuildOptions &opts,
+                   const TriangleMesh &mesh)
+  {
+    Header header;
+    if (!describe_source(source_file, opts, &header))
+      return false;
+
+    header.num_vertices = mesh.num_vertices;
+    header.num_triangles = mesh.num_triangles;
+    header.num_nodes = mesh.num_nodes;
+    header.vertices_offset = align_offset(sizeof(Header));
+    header.indices_offset = align_offset(header.vertices_offset + 3 * mesh.num_vertices * sizeof(float));
+    header.nodes_offset = align_offset(header.indices_offset + 3 * mesh.num_triangles * sizeof(uint32_t));
+    for (int a = 0; a < 3; ++a)
+    {
+      header.box_min[a] = mesh.box.min()[a];
+      header.box_max[a] = mesh.box.max()[a];
+    }
+
+    const std::string tmp_file = cache_file + ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream out(tmp_file, std::ios::binary);
+      auto write_at = [&](uint64_t offset, const void *data, size_t bytes)
+      {
+        static const char zeros[32] = {};
+        out.write(zeros, offset - static_cast<uint64_t>(out.tellp()));
+        out.write(static_cast<const char *>(data), bytes);
+      };
+
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      write_at(header.vertices_offset, mesh.vertices, 3 * mesh.num_vertices * sizeof(float));
+      write_at(header.indices_offset, mesh.indices, 3 * mesh.num_triangles * sizeof(uint32_t));
+      write_at(header.nodes_offset, mesh.nodes, mesh.num_nodes * sizeof(LinearBVHNode));
+      if (!out)
+      {
+        std::remove(tmp_file.c_str());
+        return false;
+      }
+    }
+
+    return std::rename(tmp_file.c_str(), cache_file.c_str()) == 0;
+  }
+}
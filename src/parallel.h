@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Worker threads that stay alive between parallel_for() calls, for code that runs many short parallel
+/// loops in a row (e.g. the wavefront renderer's stages), where starting threads for every loop would
+/// cost more than the loop itself. The calling thread works on each loop too, so a pool of num_threads
+/// has num_threads - 1 workers.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(int num_threads)
+  {
+    for (int t_idx = 0; t_idx < num_threads - 1; ++t_idx)
+      workers.emplace_back(&ThreadPool::work, this);
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : workers)
+      t.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int num_threads() const { return static_cast<int>(workers.size()) + 1; }
+
+  /// Run fn(begin, end) over chunks of [0, n) on all threads of the pool. Chunks are handed out
+  /// dynamically, so uneven per-item cost is balanced out. Blocks until all chunks are done.
+  template <typename Fn>
+  void parallel_for(int n, Fn fn, int chunk_size = 256)
+  {
+    if (n <= 0)
+      return;
+    if (workers.empty() || n <= chunk_size)
+    {
+      fn(0, n);
+      return;
+    }
+
+    Job job;
+    job.n = n;
+    job.chunk_size = chunk_size;
+    job.fn = &fn;
+    job.call = [](void *f, int begin, int end)
+    { (*static_cast<Fn *>(f))(begin, end); };
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      current_job = &job;
+      num_busy = static_cast<int>(workers.size());
+      ++generation;
+    }
+    wake.notify_all();
+
+    run(job); // calling thread helps out too
+
+    // Workers may only move on once every one of them is done with job, which lives on this stack
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]()
+              { return num_busy == 0; });
+    current_job = nullptr;
+  }
+
+private:
+  struct Job
+  {
+    int n;
+    int chunk_size;
+    void *fn;
+    void (*call)(void *fn, int begin, int end);
+    std::atomic<int> next_chunk{0};
+  };
+
+  static void run(Job &job)
+  {
+    while (true)
+    {
+      const int begin = job.next_chunk.fetch_add(job.chunk_size, std::memory_order_relaxed);
+      if (begin >= job.n)
+        return;
+      job.call(job.fn, begin, std::min(job.n, begin + job.chunk_size));
+    }
+  }
+
+  void work()
+  {
+    uint64_t seen_generation = 0;
+    while (true)
+    {
+      Job *job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&]()
+                  { return stopping || generation != seen_generation; });
+        if (stopping)
+          return;
+        seen_generation = generation;
+        job = current_job;
+      }
+
+      run(*job);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--num_busy == 0)
+        done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake; // new job, or stopping
+  std::condition_variable done; // all workers finished the current job
+  Job *current_job = nullptr;
+  uint64_t generation = 0; // incremented for every job
+  int num_busy = 0;        // workers still running the current job
+  bool stopping = false;
+};
+
+/// Run fn(begin, end) over chunks of [0, n) on num_threads threads, started for just this call. Chunks
+/// are handed out dynamically, so uneven per-item cost is balanced out. Blocks until all chunks are done.
+template <typename Fn>
+void parallel_for(int n, int num_threads, Fn fn, int chunk_size = 256)
+{
+  if (n <= 0)
+    return;
+
+  ThreadPool pool(std::min(num_threads, (n + chunk_size - 1) / chunk_size));
+  pool.parallel_for(n, fn, chunk_size);
+}
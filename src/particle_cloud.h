@@ -0,0 +1,269 @@
+#pragma once
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "parallel.h"
+#include "sphere.h"
+#include "sphere_pack.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Many spheres of the same radius and material, e.g. the particles of a fluid simulation, as one
+/// Hittable. Centers are stored as floats in SpherePacks, one pack per leaf of the cloud's own flattened
+/// BVH, so that a leaf is intersected with one SIMD kernel (8 wide with AVX, else 4). That's about 16
+/// bytes per particle plus the BVH, with no per-particle allocation or virtual call, instead of a Sphere
+/// and its shared_ptr per particle.
+///
+/// Spheres are intersected in float, like Sphere with single_precision. Moving the particles refits the
+/// BVH, and rebuilds it only once refitting has made it too slow.
+class ParticleCloud : public Hittable
+{
+public:
+  ParticleCloud(const std::vector<Point3> &positions, double radius, shared_ptr<Material> m,
+                const BVHBuildOptions &opts = BVHBuildOptions())
+      : radius(radius), mat_ptr(m), opts(opts)
+  {
+    build(positions);
+  }
+
+  virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    uint32_t pack, lane;
+    double t;
+    if (!query<false>(r, t_min, t_max, &pack, &lane, &t))
+      return false;
+    result->t = t;
+    result->object = this;
+    result->prim = pack * pack_width + lane;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override;
+
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    uint32_t pack, lane;
+    return query<false>(r, t_min, t_max, &pack, &lane, t);
+  }
+
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override
+  {
+    uint32_t pack, lane;
+    double t;
+    return query<true>(r, t_min, t_max, &pack, &lane, &t);
+  }
+
+  virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
+  {
+    *output_box = box;
+    return num_particles > 0;
+  }
+
+  /// Set new positions for the same particles, in the same order as on construction, and refit the BVH.
+  /// If refitting made the BVH more than max_cost_ratio times as expensive as it was right after it was
+  /// built, rebuild it instead. Returns true if the BVH was rebuilt. positions must have one entry per
+  /// particle; otherwise nothing is moved
+  bool move_particles(const std::vector<Point3> &positions, double max_cost_ratio = 1.5);
+
+  /// Expected cost of a ray query against the cloud's BVH, same measure as BVHNode::sah_cost()
+  double sah_cost() const
+  {
+    return bvh::sah_cost(nodes.data(), nodes.size(), [](const LinearBVHNode &)
+                         { return bvh::intersection_cost; });
+  }
+
+  Point3 center(uint32_t pack, uint32_t lane) const
+  {
+    return Point3(packs[pack].center[0][lane], packs[pack].center[1][lane], packs[pack].center[2][lane]);
+  }
+
+public:
+#ifdef __AVX__
+  static constexpr int pack_width = 8;
+#else
+  static constexpr int pack_width = 4;
+#endif
+
+  double radius;
+  shared_ptr<Material> mat_ptr;
+  size_t num_particles = 0;
+  AABB box;
+
+  // Leaves hold up to pack_width particles, and a leaf's offset is the index of its pack
+  std::vector<LinearBVHNode> nodes;
+  std::vector<SpherePack<pack_width> > packs;
+
+private:
+  BVHBuildOptions opts;
+  double built_sah_cost = 0;
+
+  void build(const std::vector<Point3> &positions);
+
+  /// Closest hit (or with AnyHit, any hit) in [t_min, t_max]: pack and lane of the particle, and distance
+  template <bool AnyHit>
+  bool query(const Ray &r, double t_min, double t_max, uint32_t *hit_pack, uint32_t *hit_lane, double *t) const
+  {
+    if (nodes.empty())
+      return false;
+
+    const RayT<float> ray(r);
+    const float float_radius = static_cast<float>(radius);
+    const bvh::RayTraversalData traversal_ray(r);
+    auto test_node = [&](int i, double t_closest, float *t_entry)
+    { return bvh::slab_test(nodes[i].bounds_min, nodes[i].bounds_max, traversal_ray, t_min, t_closest, t_entry); };
+    return bvh::traverse_nodes<AnyHit>(nodes.data(), t_max, test_node, [&](int leaf, double *t_closest)
+                                       {
+                                         const auto &node = nodes[leaf];
+                                         float t_lane[pack_width];
+                                         int mask = sphere_pack::intersect(packs[node.offset], node.num_primitives, float_radius, ray,
+                                                                           float(t_min), float(*t_closest), t_lane);
+                                         bool hit_anything = false;
+                                         while (mask)
+                                         {
+                                           const int lane = __builtin_ctz(mask);
+                                           mask &= mask - 1;
+
+                                           // Rounding t_min, t_closest to float can widen the interval slightly
+                                           if (t_lane[lane] < t_min || t_lane[lane] > *t_closest)
+                                             continue;
+                                           *t_closest = *t = t_lane[lane];
+                                           *hit_pack = node.offset;
+                                           *hit_lane = lane;
+                                           if (AnyHit)
+                                             return true;
+                                           hit_anything = true;
+                                         }
+                                         return hit_anything; });
+  }
+
+  /// Bounds of all nodes from the current pack centers, children before parents
+  void fit_bounds();
+};
+
+void ParticleCloud::build(const std::vector<Point3> &positions)
+{
+  num_particles = positions.size();
+  nodes.clear();
+  packs.clear();
+  if (num_particles == 0)
+    return;
+
+  std::vector<bvh::BuildPrimitive> prims(num_particles);
+  parallel_for(static_cast<int>(num_particles), opts.num_threads, [&](int begin, int end)
+               {
+                 for (int i = begin; i < end; ++i)
+                 {
+                   // Bounds of the center that is actually intersected, i.e. rounded to float
+                   const Point3 center = Point3(Vec3T<float>(positions[i]));
+                   const Vec3 extent(radius, radius, radius);
+                   prims[i].box = AABB(center - extent, center + extent);
+                   prims[i].centroid = center;
+                   prims[i].index = i;
+                 }
+               },
+               bvh::parallel_build_min_primitives);
+
+  BVHBuildOptions pack_opts = opts;
+  pack_opts.max_leaf_size = pack_width; // one pack per leaf
+  box = bvh::bounds(prims.data(), 0, num_particles);
+  bvh::build_nodes(prims.data(), 0, num_particles, pack_opts, pack_opts.num_threads, &nodes, pack_width);
+
+  for (auto &node : nodes)
+  {
+    if (node.num_primitives == 0)
+      continue;
+
+    SpherePack<pack_width> pack = {};
+    for (uint32_t lane = 0; lane < node.num_primitives; ++lane)
+    {
+      const size_t i = prims[node.offset + lane].index;
+      for (int a = 0; a < 3; ++a)
+        pack.center[a][lane] = static_cast<float>(positions[i][a]);
+      pack.id[lane] = static_cast<uint32_t>(i);
+    }
+    node.offset = packs.size();
+    packs.push_back(pack);
+  }
+
+  built_sah_cost = sah_cost();
+}
+
+void ParticleCloud::fit_bounds()
+{
+  // Children are always stored after their parent, so going backwards visits children first
+  for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i)
+  {
+    auto &node = nodes[i];
+    if (node.num_primitives > 0)
+    {
+      const auto &pack = packs[node.offset];
+      for (int a = 0; a < 3; ++a)
+      {
+        float lo = pack.center[a][0], hi = pack.center[a][0];
+        for (uint32_t lane = 1; lane < node.num_primitives; ++lane)
+        {
+          lo = std::min(lo, pack.center[a][lane]);
+          hi = std::max(hi, pack.center[a][lane]);
+        }
+        node.bounds_min[a] = bvh::round_down(lo - radius);
+        node.bounds_max[a] = bvh::round_up(hi + radius);
+      }
+      continue;
+    }
+
+    const auto &first = nodes[i + 1];
+    const auto &second = nodes[node.offset];
+    for (int a = 0; a < 3; ++a)
+    {
+      node.bounds_min[a] = std::min(first.bounds_min[a], second.bounds_min[a]);
+      node.bounds_max[a] = std::max(first.bounds_max[a], second.bounds_max[a]);
+    }
+  }
+
+  box = AABB(Point3(nodes[0].bounds_min[0], nodes[0].bounds_min[1], nodes[0].bounds_min[2]),
+             Point3(nodes[0].bounds_max[0], nodes[0].bounds_max[1], nodes[0].bounds_max[2]));
+}
+
+bool ParticleCloud::move_particles(const std::vector<Point3> &positions, double max_cost_ratio)
+{
+  assert(positions.size() == num_particles);
+  if (positions.size() != num_particles || nodes.empty())
+    return false;
+
+  for (auto &node : nodes)
+  {
+    if (node.num_primitives == 0)
+      continue;
+
+    auto &pack = packs[node.offset];
+    for (uint32_t lane = 0; lane < node.num_primitives; ++lane)
+      for (int a = 0; a < 3; ++a)
+        pack.center[a][lane] = static_cast<float>(positions[pack.id[lane]][a]);
+  }
+  fit_bounds();
+
+  if (sah_cost() <= max_cost_ratio * built_sah_cost)
+    return false;
+
+  build(positions);
+  return true;
+}
+
+void ParticleCloud::surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const
+{
+  rec->t = hit.t;
+  rec->p = r.at(rec->t);
+  const Vec3 outward_normal = (rec->p - center(hit.prim / pack_width, hit.prim % pack_width)) / radius;
+  rec->set_face_normal(r, outward_normal);
+  Sphere::get_sphere_uv(outward_normal, rec->u, rec->v);
+  rec->mat_ptr = mat_ptr.get();
+}
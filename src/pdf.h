@@ -1,9 +1,10 @@
 #pragma once
 
 #include "common.h"
+#include "hittable.h"
 #include "orthonormal_bases.h"
 
-#include <vector>
+#include <initializer_list>
 
 /// Return random vector in hemisphere wrt z axis
 inline Vec3 random_cosine_direction()
@@ -63,11 +64,12 @@ public:
   OrthonormalBases uvw;
 };
 
-/// PDF for sampling towards a hittable
+/// PDF for sampling towards a hittable. Doesn't own the hittable, so it can live on the stack without
+/// touching a reference count
 class HittablePDF : public PDF
 {
 public:
-  HittablePDF(shared_ptr<Hittable> object_ptr, const Point3 &origin) : ptr(object_ptr), o(origin) {}
+  HittablePDF(const Hittable &object, const Point3 &origin) : ptr(&object), o(origin) {}
 
   virtual double value(const Vec3 &direction) const override
   {
@@ -80,33 +82,44 @@ public:
   }
 
 public:
-  shared_ptr<Hittable> ptr;
+  const Hittable *ptr;
   Point3 o;
 };
 
+/// Uniform mixture of up to max_pdfs PDFs. Refers to the PDFs without owning them, and keeps them in a
+/// fixed-size array, so that a mixture per bounce doesn't allocate
 class MixturePDF : public PDF
 {
 public:
-  // Assume uniform weighting for now
-  MixturePDF(std::vector<shared_ptr<PDF> > pdfs) : p(pdfs), weight(1.0 / pdfs.size())
+  static constexpr int max_pdfs = 4;
+
+  MixturePDF(std::initializer_list<const PDF *> pdfs)
   {
-    assert(!pdfs.empty());
+    for (const PDF *pdf : pdfs)
+      add(pdf);
+  }
+
+  void add(const PDF *pdf)
+  {
+    assert(num_pdfs < max_pdfs);
+    p[num_pdfs++] = pdf;
   }
 
   virtual double value(const Vec3 &direction) const override
   {
+    assert(num_pdfs > 0);
     double prob = 0.0;
-    for (size_t i = 0; i < p.size(); ++i)
-      prob += weight * p[i]->value(direction);
-    return prob;
+    for (int i = 0; i < num_pdfs; ++i)
+      prob += p[i]->value(direction);
+    return prob / num_pdfs;
   }
 
   virtual Vec3 generate() const override
   {
-    return p[random_int(0, p.size() - 1)]->generate();
+    return p[random_int(0, num_pdfs - 1)]->generate();
   }
 
 public:
-  std::vector<shared_ptr<PDF> > p;
-  double weight;
-};
\ No newline at end of file
+  const PDF *p[max_pdfs];
+  int num_pdfs = 0;
+};
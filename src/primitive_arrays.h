@@ -0,0 +1,201 @@
+#pragma once
+
+#include "common.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "hittable.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// Primitives of a compiled BVH, copied into one contiguous array per built-in type (spheres, triangles,
+/// axis-aligned rects and boxes). Each leaf's primitives are ordered by type, so a leaf is a few typed
+/// ranges, and for_each() runs one loop per range with direct, inlinable calls on the concrete type.
+/// Anything else (e.g. nested BVHs, meshes, transforms) is called through Hittable as before.
+///
+/// Copies are made from the BVH's shared primitives in leaf order, so that each leaf's primitives of one
+/// type are contiguous in memory. Changes to the shared primitives aren't seen until assign() copies them
+/// again: LinearBVH::refit() does, other BVHs need to be rebuilt.
+class PrimitiveArrays
+{
+public:
+  enum Kind : uint8_t
+  {
+    sphere,
+    triangle,
+    yz_rect,
+    xz_rect,
+    xy_rect,
+    box,
+    other
+  };
+
+  static Kind kind(const Hittable &prim)
+  {
+    if (dynamic_cast<const Sphere *>(&prim))
+      return sphere;
+    if (dynamic_cast<const Triangle *>(&prim))
+      return triangle;
+    if (dynamic_cast<const YZRect *>(&prim))
+      return yz_rect;
+    if (dynamic_cast<const XZRect *>(&prim))
+      return xz_rect;
+    if (dynamic_cast<const XYRect *>(&prim))
+      return xy_rect;
+    if (dynamic_cast<const Box *>(&prim))
+      return box;
+    return other;
+  }
+
+  /// Order one leaf's primitives, [begin, end) of prims, by type. Each primitive's type is looked up once
+  static void sort_leaf(std::vector<shared_ptr<Hittable> > &prims, size_t begin, size_t end)
+  {
+    std::vector<std::pair<Kind, shared_ptr<Hittable> > > keyed;
+    keyed.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i)
+      keyed.emplace_back(kind(*prims[i]), std::move(prims[i]));
+    std::stable_sort(keyed.begin(), keyed.end(), [](const auto &a, const auto &b)
+                     { return a.first < b.first; });
+    for (size_t i = begin; i < end; ++i)
+      prims[i] = std::move(keyed[i - begin].second);
+  }
+
+  /// Copy prims, in leaf order with each leaf sorted by sort_leaf(), into the typed arrays
+  void assign(const std::vector<shared_ptr<Hittable> > &prims)
+  {
+    spheres.clear();
+    triangles.clear();
+    yz_rects.clear();
+    xz_rects.clear();
+    xy_rects.clear();
+    boxes.clear();
+    others.clear();
+    refs.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); ++i)
+    {
+      const Hittable &prim = *prims[i];
+      refs[i].kind = kind(prim);
+      switch (refs[i].kind)
+      {
+      case sphere:
+        refs[i].index = add(&spheres, static_cast<const Sphere &>(prim));
+        break;
+      case triangle:
+        refs[i].index = add(&triangles, static_cast<const Triangle &>(prim));
+        break;
+      case yz_rect:
+        refs[i].index = add(&yz_rects, static_cast<const YZRect &>(prim));
+        break;
+      case xz_rect:
+        refs[i].index = add(&xz_rects, static_cast<const XZRect &>(prim));
+        break;
+      case xy_rect:
+        refs[i].index = add(&xy_rects, static_cast<const XYRect &>(prim));
+        break;
+      case box:
+        refs[i].index = add(&boxes, static_cast<const Box &>(prim));
+        break;
+      default:
+        refs[i].index = add(&others, &prim);
+      }
+    }
+  }
+
+  /// Calls f(prim) for primitives [begin, begin + count) in leaf order, with prim as its concrete type
+  /// (const Hittable & for other types). f returns whether prim was hit. Returns whether any was; with
+  /// AnyHit, stops at the first one
+  template <bool AnyHit, typename Fn>
+  bool for_each(uint32_t begin, uint32_t count, Fn &&f) const
+  {
+    bool hit_anything = false;
+    const uint32_t end = begin + count;
+    for (uint32_t i = begin; i < end;)
+    {
+      const Ref ref = refs[i];
+      uint32_t run = 1;
+      while (i + run < end && refs[i + run].kind == ref.kind)
+        ++run;
+      i += run;
+
+      bool hit;
+      switch (ref.kind)
+      {
+      case sphere:
+        hit = for_range<AnyHit>(spheres.data() + ref.index, run, f);
+        break;
+      case triangle:
+        hit = for_range<AnyHit>(triangles.data() + ref.index, run, f);
+        break;
+      case yz_rect:
+        hit = for_range<AnyHit>(yz_rects.data() + ref.index, run, f);
+        break;
+      case xz_rect:
+        hit = for_range<AnyHit>(xz_rects.data() + ref.index, run, f);
+        break;
+      case xy_rect:
+        hit = for_range<AnyHit>(xy_rects.data() + ref.index, run, f);
+        break;
+      case box:
+        hit = for_range<AnyHit>(boxes.data() + ref.index, run, f);
+        break;
+      default:
+        hit = false;
+        for (uint32_t k = 0; k < run && !(AnyHit && hit); ++k)
+          hit |= f(*others[ref.index + k]);
+      }
+      if (hit)
+      {
+        if (AnyHit)
+          return true;
+        hit_anything = true;
+      }
+    }
+    return hit_anything;
+  }
+
+public:
+  std::vector<Sphere> spheres;
+  std::vector<Triangle> triangles;
+  std::vector<YZRect> yz_rects;
+  std::vector<XZRect> xz_rects;
+  std::vector<XYRect> xy_rects;
+  std::vector<Box> boxes;
+  std::vector<const Hittable *> others; // owned by the BVH's primitives
+
+private:
+  /// Where the primitive at some position in leaf order is: its type, and index in that type's array
+  struct Ref
+  {
+    uint32_t index;
+    Kind kind;
+  };
+  std::vector<Ref> refs;
+
+  template <typename T>
+  static uint32_t add(std::vector<T> *prims, const T &prim)
+  {
+    prims->push_back(prim);
+    return static_cast<uint32_t>(prims->size() - 1);
+  }
+
+  template <bool AnyHit, typename T, typename Fn>
+  static bool for_range(const T *prims, uint32_t count, Fn &f)
+  {
+    bool hit_anything = false;
+    for (uint32_t k = 0; k < count; ++k)
+    {
+      if (f(prims[k]))
+      {
+        if (AnyHit)
+          return true;
+        hit_anything = true;
+      }
+    }
+    return hit_anything;
+  }
+};
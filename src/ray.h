@@ -2,26 +2,36 @@
 
 #include "vec3.h"
 
-class Ray
+/// Ray with Scalar (double or float) origin and direction; see Vec3T
+template <typename Scalar>
+class RayT
 {
 public:
-  Ray() {}
-  Ray(const Point3 &origin, const Vec3 &direction, double time = 0.0)
+  RayT() {}
+  RayT(const Vec3T<Scalar> &origin, const Vec3T<Scalar> &direction, double time = 0.0)
       : orig(origin), dir(direction), tm(time)
   {
   }
 
-  Point3 origin() const { return orig; }
-  Vec3 direction() const { return dir; }
+  /// Conversion between precisions, e.g. to intersect a primitive in single precision
+  template <typename Other>
+  explicit RayT(const RayT<Other> &r) : orig(r.orig), dir(r.dir), tm(r.tm)
+  {
+  }
+
+  Vec3T<Scalar> origin() const { return orig; }
+  Vec3T<Scalar> direction() const { return dir; }
   double time() const { return tm; }
 
-  Point3 at(double t) const
+  Vec3T<Scalar> at(Scalar t) const
   {
     return orig + t * dir;
   }
 
 public:
-  Point3 orig;
-  Vec3 dir;
+  Vec3T<Scalar> orig;
+  Vec3T<Scalar> dir;
   double tm;
-};
\ No newline at end of file
+};
+
+using Ray = RayT<double>;
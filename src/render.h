@@ -6,112 +6,329 @@
 #include "material.h"
 #include "hittable.h"
 #include "pdf.h"
+#include "tile_scheduler.h"
 #include "timing.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 
-Color ray_color(const Ray &r, const Color &background, const Hittable &world, shared_ptr<Hittable> lights, int depth)
+/// Paths are guaranteed to survive this many bounces before Russian roulette may terminate them
+static constexpr int russian_roulette_min_bounces = 3;
+
+/// How paths gather light from the scene's lights (the Hittable passed as lights to the renderers)
+enum class Integrator
+{
+  // Continue each non-specular path vertex in one direction, sampled from a 50/50 mixture of the
+  // material's scatter PDF and a PDF towards the lights; light is picked up only where paths hit it
+  Mixture,
+  // Next-event estimation: at each non-specular vertex, also trace a shadow ray towards a point sampled
+  // on the lights, and continue the path by sampling the material's scatter PDF. Light reached by either
+  // strategy is weighted with the power heuristic (multiple importance sampling), so each strategy
+  // counts mostly where it's the better one, e.g. shadow rays for small lights
+  NextEventEstimation
+};
+
+/// Multiple importance sampling weight for a sample from the strategy with density pdf, when the other
+/// strategy has density other_pdf in the same direction (power heuristic with exponent 2)
+inline double power_heuristic(double pdf, double other_pdf)
+{
+  const double pdf_squared = pdf * pdf;
+  return pdf_squared / (pdf_squared + other_pdf * other_pdf);
+}
+
+/// Shadow ray towards the lights from next-event estimation. Shading only samples it, so that renderers
+/// can trace shadow rays when it suits them, e.g. all of a bounce's in one batch: tracing draws no random
+/// numbers, so when it happens doesn't change the image
+struct ShadowRay
 {
-  // If we've exceeded the ray bounce limit, no more light is gathered.
-  if (depth <= 0)
+  Ray ray;
+  Color throughput;  // of the path at the shaded vertex
+  Color attenuation; // of the material at the shaded vertex
+  double weight;     // likelihood ratio times MIS weight
+};
+
+/// Next-event estimation at a non-specular hit: sample a direction from rec.p towards the lights, MIS-
+/// weighted against sampling the scatter PDF. Nothing if either PDF is zero there, as the shadow ray
+/// then can't contribute
+std::optional<ShadowRay> sample_light(const Ray &r, const hit_record &rec, const scatter_record &srec,
+                                      const Hittable &lights, const Color &throughput)
+{
+  const HittablePDF light_pdf(lights, rec.p);
+  const Ray shadow_ray(rec.p, light_pdf.generate(), r.time());
+  const double light_pdf_value = light_pdf.value(shadow_ray.direction());
+  const double scatter_pdf_value = srec.pdf_ptr()->value(shadow_ray.direction());
+  if (light_pdf_value <= 0 || scatter_pdf_value <= 0)
+    return std::nullopt;
+
+  return ShadowRay{shadow_ray, throughput, srec.attenuation,
+                   scatter_pdf_value / light_pdf_value * power_heuristic(light_pdf_value, scatter_pdf_value)};
+}
+
+/// Light that a shadow ray brings to its path: whatever the ray hits first emits towards the shaded
+/// point, if anything, be it the sampled light or something in the way
+Color trace_shadow_ray(const ShadowRay &shadow, const Hittable &world)
+{
+  hit_record light_rec;
+  if (!world.hit(shadow.ray, 0.001, infinity, &light_rec))
     return Color(0, 0, 0);
+  const Color emitted = material::visit(*light_rec.mat_ptr, [&](const auto &material)
+                                        { return material.emitted(shadow.ray, light_rec, light_rec.u, light_rec.v, light_rec.p); });
 
-  timing::Timer hit_timer("ray_color/hit");
-  hit_record rec;
-  // If the ray hits nothing, return the background color.
-  if (!world.hit(r, 0.001, infinity, &rec))
-    return background;
-  hit_timer.stop();
+  return shadow.throughput * (shadow.attenuation * emitted * shadow.weight);
+}
 
-  timing::Timer emit_timer("ray_color/emit");
-  Color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
-  emit_timer.stop();
+/// shade_hit() for a hit whose material (rec.mat_ptr) is known to be an M, e.g. from material::visit().
+/// Calls to built-in materials then are direct, so a batch of hits on the same kind of material can be
+/// shaded without an indirect call per hit
+template <class M>
+bool shade_hit(const M &material, const Ray &r, const hit_record &rec, const Hittable *lights,
+               Integrator integrator, int bounce, Color *radiance, Color *throughput, double *emission_weight,
+               Ray *next_ray, std::optional<ShadowRay> *shadow_ray)
+{
+  shadow_ray->reset();
+  *radiance += *throughput * *emission_weight * material.emitted(r, rec, rec.u, rec.v, rec.p);
+  *emission_weight = 1;
 
-  timing::Timer scatter_timer("ray_color/scatter");
   scatter_record srec;
-  if (!rec.mat_ptr->scatter(r, rec, &srec))
-    return emitted;
-  scatter_timer.stop();
+  if (!material.scatter(r, rec, &srec))
+    return false;
 
-  // Skip importance sampling for specular reflections
   if (srec.is_specular)
-    return emitted + srec.attenuation * ray_color(srec.specular_ray, background, world, lights, depth - 1);
+  {
+    // Skip importance sampling for specular reflections
+    *throughput = *throughput * srec.attenuation;
+    *next_ray = srec.specular_ray;
+  }
+  else if (integrator == Integrator::NextEventEstimation && lights != nullptr)
+  {
+    *shadow_ray = sample_light(r, rec, srec, *lights, *throughput);
+
+    // Continue by sampling the scatter PDF, which makes the likelihood ratio 1. If the path hits a light
+    // next, that light gets weighted against having sampled it from here with sample_light()
+    const PDF *scatter_pdf = srec.pdf_ptr();
+    const Ray scattered(rec.p, scatter_pdf->generate(), r.time());
+    const double scatter_pdf_value = scatter_pdf->value(scattered.direction());
+    if (scatter_pdf_value <= 0)
+      return false;
+
+    *emission_weight = power_heuristic(scatter_pdf_value, lights->pdf_value(rec.p, scattered.direction()));
+    *throughput = *throughput * srec.attenuation;
+    *next_ray = scattered;
+  }
+  else
+  {
+    // Importance sampling: scatter pdf of hit material + sample towards lights. All on the stack
+    const PDF *scatter_pdf = srec.pdf_ptr();
+    MixturePDF mixed_pdf{scatter_pdf};
+    std::optional<HittablePDF> light_pdf;
+    if (lights != nullptr)
+      mixed_pdf.add(&light_pdf.emplace(*lights, rec.p));
+
+    auto scattered = Ray(rec.p, mixed_pdf.generate(), r.time());
+    const double likelihood_ratio = scatter_pdf->value(scattered.direction()) / mixed_pdf.value(scattered.direction());
+
+    *throughput = *throughput * srec.attenuation * likelihood_ratio;
+    *next_ray = scattered;
+  }
+
+  if (bounce >= russian_roulette_min_bounces)
+  {
+    const double survive_prob = fmin(0.95, fmax(throughput->x(), fmax(throughput->y(), throughput->z())));
+    if (random_double() >= survive_prob)
+      return false;
+    *throughput /= survive_prob;
+  }
+
+  return true;
+}
+
+/// Shade one path vertex: add light emitted at the hit (weighted by emission_weight, which the previous
+/// vertex set), then sample the direction the path continues in and update its throughput and
+/// emission_weight. Returns false if the path ends at this vertex. next_ray may alias r, and lights may
+/// be nullptr if there are none to sample. With next-event estimation, shadow_ray is set to the vertex's
+/// shadow ray, if any, even if the path ends; its light is added to radiance after it's traced
+bool shade_hit(const Ray &r, const hit_record &rec, const Hittable *lights, Integrator integrator, int bounce,
+               Color *radiance, Color *throughput, double *emission_weight, Ray *next_ray,
+               std::optional<ShadowRay> *shadow_ray)
+{
+  return material::visit(*rec.mat_ptr, [&](const auto &material)
+                         { return shade_hit(material, r, rec, lights, integrator, bounce, radiance, throughput,
+                                            emission_weight, next_ray, shadow_ray); });
+}
+
+/// Iterative path tracer: follows a single path for up to max_depth bounces, carrying the product of
+/// attenuations / likelihood ratios along the path as throughput. After a few bounces, paths are
+/// terminated with probability based on throughput (Russian roulette); surviving paths are re-weighted
+/// by 1/p, so the expected image is the same as tracing every path to max_depth.
+Color ray_color(const Ray &r_in, const Color &background, const Hittable &world, const Hittable *lights, int max_depth,
+                Integrator integrator = Integrator::Mixture)
+{
+  Color radiance(0, 0, 0);
+  Color throughput(1, 1, 1);
+  double emission_weight = 1;
+  Ray r = r_in;
+
+  for (int bounce = 1; bounce <= max_depth; ++bounce)
+  {
+    rng::start_bounce(bounce);
+
+    hit_record rec;
+    // If the ray hits nothing, return the background color.
+    if (!world.hit(r, 0.001, infinity, &rec))
+    {
+      radiance += throughput * background;
+      break;
+    }
+
+    std::optional<ShadowRay> shadow_ray;
+    const bool survives = shade_hit(r, rec, lights, integrator, bounce, &radiance, &throughput, &emission_weight, &r,
+                                    &shadow_ray);
+    if (shadow_ray)
+      radiance += trace_shadow_ray(*shadow_ray, world);
+    if (!survives)
+      break;
+  }
+
+  return radiance;
+}
 
-  // Importance sampling: scatter pdf of hit material + sample towards lights
-  std::vector<shared_ptr<PDF> > pdfs = {srec.pdf_ptr};
-  if (lights != nullptr)
-    pdfs.push_back(make_shared<HittablePDF>(lights, rec.p));
-  MixturePDF mixed_pdf(pdfs);
+struct RenderOptions
+{
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  int tile_size = 16; // tiles are tile_size x tile_size pixels
+  TileOrder tile_order = TileOrder::Spiral;
+  bool print_progress = true;     // turn off for batch jobs
+  int progress_interval_ms = 250; // how often progress gets reported, if print_progress is set
+
+  int wavefront_batch_size = 1 << 16; // number of paths in flight at once, for render_wavefront()
 
-  timing::Timer sampling_timer("ray_color/sample_pdf");
-  auto scattered = Ray(rec.p, mixed_pdf.generate(), r.time());
-  const double likelihood_ratio = srec.pdf_ptr->value(scattered.direction()) / mixed_pdf.value(scattered.direction());
-  sampling_timer.stop();
+  Integrator integrator = Integrator::Mixture;
+};
 
-  return emitted + srec.attenuation * ray_color(scattered, background, world, lights, depth - 1) * likelihood_ratio;
+/// Reports render progress on std::cerr from its own thread, so that render threads only have to
+/// bump an atomic counter
+class ProgressReporter
+{
+public:
+  ProgressReporter(const std::atomic<int> &pixels_done, int total_pixels, int interval_ms)
+      : thread(&ProgressReporter::run, this, std::cref(pixels_done), total_pixels, interval_ms)
+  {
+  }
+
+  ~ProgressReporter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mut);
+      done = true;
+    }
+    cv.notify_one();
+    thread.join();
+  }
+
+private:
+  void run(const std::atomic<int> &pixels_done, int total_pixels, int interval_ms)
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    while (true)
+    {
+      const bool finished = cv.wait_for(lock, std::chrono::milliseconds(interval_ms), [this]()
+                                        { return done; });
+      const int percent = int(double(pixels_done.load(std::memory_order_relaxed)) / total_pixels * 100);
+      std::cerr << "\rPixels done: " << percent << "% " << std::flush;
+      if (finished)
+        return;
+    }
+  }
+
+  std::mutex mut;
+  std::condition_variable cv;
+  bool done = false;
+  std::thread thread; // declared last, so that it starts after everything else is initialized
+};
+
+/// Write pixel values (row-major, from top down) as plain ppm image
+void write_ppm(std::ostream &out, int H, int W, const std::vector<Color> &pixel_values)
+{
+  out << "P3\n"
+      << W << ' ' << H << "\n255\n";
+  for (const auto &c : pixel_values)
+    write_color(out, c);
 }
 
-void render(std::ostream &out, const Hittable &world, shared_ptr<Hittable> lights, const Camera &cam, int H, int W, const Color &background, int samples_per_pixel, int max_depth, int num_threads = std::thread::hardware_concurrency(), bool print_progress = true)
+void render(std::ostream &out, const Hittable &world, shared_ptr<Hittable> lights, const Camera &cam, int H, int W, const Color &background, int samples_per_pixel, int max_depth, const RenderOptions &opts = RenderOptions())
 {
+  // Each pixel is owned by exactly one tile, so threads write their pixels without synchronization
   std::vector<Color> pixel_values(H * W);
-  int num_pixels_done = 0;
-  std::mutex color_mutex;
+  std::atomic<int> num_pixels_done(0);
 
-  auto render_rows = [&](int r0, int r1) // inclusive range
+  auto render_tile = [&](const Tile &tile)
   {
-    for (int row = r0; row <= r1; ++row)
+    for (int row = tile.row0; row < tile.row1; ++row)
     {
-      for (int col = 0; col < W; ++col)
+      for (int col = tile.col0; col < tile.col1; ++col)
       {
         Color pixel_color(0, 0, 0);
         for (int s = 0; s < samples_per_pixel; ++s)
         {
+          rng::start_path(row * W + col, s);
           auto u = (col + random_double()) / (W - 1);
           auto v = (row + random_double()) / (H - 1);
           Ray r = cam.get_ray(u, v);
 
-          pixel_color += ray_color(r, background, world, lights, max_depth);
+          pixel_color += ray_color(r, background, world, lights.get(), max_depth, opts.integrator);
         }
         pixel_color /= samples_per_pixel;
 
         // pixel values are listed in row-major order in ppm format, from top down
         int c_idx = col + (H - 1 - row) * W;
-
-        std::lock_guard<std::mutex> lock(color_mutex);
         pixel_values[c_idx] = pixel_color;
-        if (print_progress)
-          std::cerr << "\rPixels done: " << int(double(++num_pixels_done) / (H * W) * 100) << "% " << std::flush;
       }
     }
+
+    num_pixels_done.fetch_add((tile.row1 - tile.row0) * (tile.col1 - tile.col0), std::memory_order_relaxed);
+  };
+
+  // Threads pull tiles from a shared work-stealing queue, so that expensive regions of the image
+  // get spread out over all threads instead of landing on whoever owns that block of rows
+  const int num_threads = std::max(1, opts.num_threads);
+  TileScheduler scheduler(make_tiles(H, W, opts.tile_size, opts.tile_order), num_threads);
+
+  std::unique_ptr<ProgressReporter> reporter;
+  if (opts.print_progress)
+    reporter = std::make_unique<ProgressReporter>(num_pixels_done, H * W, opts.progress_interval_ms);
+
+  auto worker = [&](int worker_idx)
+  {
+    Tile tile;
+    while (scheduler.next(worker_idx, &tile))
+      render_tile(tile);
   };
 
   if (num_threads == 1)
   {
-    render_rows(0, H - 1);
+    worker(0);
   }
   else
   {
     std::vector<std::thread> threads(num_threads);
-    int rows_per_thread = H / num_threads;
-
     for (int t_idx = 0; t_idx < num_threads; ++t_idx)
-    {
-      int start_row = t_idx * rows_per_thread;
-      int end_row = t_idx == num_threads - 1 ? H - 1 : start_row + rows_per_thread - 1;
-      threads[t_idx] = std::thread(render_rows, start_row, end_row);
-    }
+      threads[t_idx] = std::thread(worker, t_idx);
 
     for (int t_idx = 0; t_idx < num_threads; ++t_idx)
       threads[t_idx].join();
   }
 
-  out << "P3\n"
-      << W << ' ' << H << "\n255\n";
-  for (const auto &c : pixel_values)
-    write_color(out, c);
+  reporter.reset(); // print final progress before image gets written
 
-  if (print_progress)
+  write_ppm(out, H, W, pixel_values);
+
+  if (opts.print_progress)
     std::cerr << "\nDone.\n";
-}
\ No newline at end of file
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+/// PCG32 random number generator (XSH-RR variant): https://www.pcg-random.org
+/// Tiny state, fast, and good enough statistically for Monte Carlo rendering
+class Pcg32
+{
+public:
+  Pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+  Pcg32(uint64_t init_state, uint64_t init_seq) { seed(init_state, init_seq); }
+
+  /// init_seq selects one of 2^63 independent streams
+  void seed(uint64_t init_state, uint64_t init_seq)
+  {
+    state = 0u;
+    inc = (init_seq << 1u) | 1u;
+    next_uint();
+    state += init_state;
+    next_uint();
+  }
+
+  uint32_t next_uint()
+  {
+    const uint64_t old_state = state;
+    state = old_state * 6364136223846793005ULL + inc;
+    const uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+    const uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+
+  /// Random real in [0,1)
+  double next_double()
+  {
+    return next_uint() * (1.0 / 4294967296.0);
+  }
+
+private:
+  uint64_t state;
+  uint64_t inc;
+};
+
+namespace rng
+{
+  /// Finalizer from splitmix64; turns structured inputs (e.g. consecutive pixel indices) into well-mixed seeds
+  inline uint64_t mix64(uint64_t x)
+  {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  /// Each thread draws from its own generator, so there is no shared state between render threads
+  inline Pcg32 &thread_generator()
+  {
+    thread_local Pcg32 generator;
+    return generator;
+  }
+
+  /// Identifies the path currently being traced on this thread
+  struct PathKey
+  {
+    uint64_t pixel = 0;
+    uint64_t sample = 0;
+  };
+
+  inline PathKey &thread_path_key()
+  {
+    thread_local PathKey key;
+    return key;
+  }
+
+  /// Re-seed this thread's generator for a given bounce of the current path. Random numbers then only
+  /// depend on (pixel, sample index, bounce), not on which thread traces the path or in which order.
+  inline void start_bounce(int bounce)
+  {
+    const auto &key = thread_path_key();
+    const uint64_t s = mix64(key.pixel ^ mix64(key.sample ^ mix64(static_cast<uint64_t>(bounce))));
+    thread_generator().seed(s, key.pixel);
+  }
+
+  /// Start tracing a camera path on this thread. Bounce 0 is camera ray generation; renderers that
+  /// switch between many paths in flight can pick up a path again at a later bounce.
+  inline void start_path(uint64_t pixel, uint64_t sample, int bounce = 0)
+  {
+    thread_path_key() = {pixel, sample};
+    start_bounce(bounce);
+  }
+}
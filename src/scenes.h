@@ -10,6 +10,9 @@
 #include "box.h"
 #include "constant_medium.h"
 #include "bvh.h"
+#include "linear_bvh.h"
+#include "particle_cloud.h"
+#include "transform.h"
 
 #include <optional>
 #include <vector>
@@ -359,10 +362,10 @@ Scene final_scene()
   }
 
   // Add two sets of repeated object sets as independent BVH nodes, since they have a lot of structure
-  objects.add(make_shared<BVHNode>(balls, 0, 1));
+  objects.add(make_shared<LinearBVH>(balls, 0, 1));
   objects.add(make_shared<Translate>(
       make_shared<RotateY>(
-          make_shared<BVHNode>(ground_boxes, 0.0, 1.0), 15),
+          make_shared<LinearBVH>(ground_boxes, 0.0, 1.0), 15),
       Vec3(-100, 270, 395)));
 
   // Add rest of objects
@@ -416,8 +419,16 @@ Scene final_scene()
   return scene;
 }
 
+/// Parts of water_in_box() that change between simulation frames
+struct WaterParticles
+{
+  shared_ptr<ParticleCloud> cloud; // particles in same order as their positions
+};
+
 /// Transparent cube with one corner at (0, 0, 0) and opposite corner at (size, size, size)
-Scene water_in_box(double box_size, double particle_size, const std::vector<Point3> &particle_positions)
+/// If particles is given, it is set to the particles' cloud, so that later frames can move the particles
+/// instead of creating a new scene
+Scene water_in_box(double box_size, double particle_size, const std::vector<Point3> &particle_positions, WaterParticles *particles = nullptr)
 {
   HittableList objects;
 
@@ -434,12 +445,11 @@ Scene water_in_box(double box_size, double particle_size, const std::vector<Poin
 
   // auto water = make_shared<Lambertian>(Color(0.5, 0.5, 1.0));
   auto water = make_shared<Dielectric>(1.3, Color(0.9, 0.9, 1.0));
-  HittableList particles;
-  for (const auto &p : particle_positions)
-  {
-    particles.add(make_shared<Sphere>(Point3(p.x(), p.y(), p.z()), particle_size, water));
-  }
-  objects.add(make_shared<BVHNode>(particles, 0, 1));
+  auto cloud = make_shared<ParticleCloud>(particle_positions, particle_size, water);
+  objects.add(cloud);
+
+  if (particles)
+    particles->cloud = cloud;
 
   Scene scene;
   scene.objects = objects;
@@ -548,4 +558,55 @@ Scene stanford_bunny()
 Scene stanford_dragon()
 {
   return mesh_side_view("./examples/meshes/dragon.obj");
-}
\ No newline at end of file
+}
+
+/// Many randomly placed, rotated and scaled copies of one mesh. All instances share the mesh's triangles
+/// and BVH; the scene's BVH only contains the instances
+Scene mesh_instances_field(const std::string &mesh_file, int num_instances)
+{
+  HittableList objects;
+
+  auto mesh = import_triangle_mesh(mesh_file, make_shared<Lambertian>(Color(.12, .45, .15)));
+  AABB mesh_bb;
+  mesh->bounding_box(0, 1, &mesh_bb);
+  const double mesh_size = (mesh_bb.max() - mesh_bb.min()).length();
+  const Point3 mesh_bottom_center(0.5 * (mesh_bb.min().x() + mesh_bb.max().x()), mesh_bb.min().y(), 0.5 * (mesh_bb.min().z() + mesh_bb.max().z()));
+
+  // Instances on a jittered grid, resting on the ground
+  const int grid_size = static_cast<int>(ceil(sqrt(num_instances)));
+  const double spacing = 1.5 * mesh_size;
+  const double field_size = grid_size * spacing;
+  HittableList instances;
+  for (int i = 0; i < num_instances; ++i)
+  {
+    const Point3 position((i % grid_size + random_double(0.25, 0.75)) * spacing - 0.5 * field_size,
+                          0,
+                          (i / grid_size + random_double(0.25, 0.75)) * spacing - 0.5 * field_size);
+    const Affine3 placement = Affine3::translation(position) *
+                              Affine3::rotation(Vec3(0, 1, 0), random_double(0, 360)) *
+                              Affine3::scaling(random_double(0.6, 1.0)) *
+                              Affine3::translation(-mesh_bottom_center);
+    instances.add(make_shared<Transform>(mesh, placement));
+  }
+  objects.add(make_shared<LinearBVH>(instances, 0, 1));
+
+  auto ground = make_shared<Lambertian>(make_shared<CheckerTexture>(Color(0.3, 0.3, 0.3), Color(0.9, 0.9, 0.9)));
+  objects.add(make_shared<XZRect>(-field_size, field_size, -field_size, field_size, 0, ground));
+
+  Scene scene;
+  scene.objects = objects;
+
+  Point3 lookfrom(0, 0.4 * field_size, -0.8 * field_size);
+  Point3 lookat(0, 0, 0);
+  Vec3 vup(0, 1, 0);
+  double dist_to_focus = 10.0;
+  double aperture = 0.0;
+  double vfov = 40.0;
+  double aspect_ratio = 16.0 / 9.0;
+  double t_start = 0.0;
+  double t_end = 1.0;
+  scene.cam = Camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, t_start, t_end);
+
+  scene.background = Color(0.7, 0.8, 1.0);
+  return scene;
+}
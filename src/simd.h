@@ -0,0 +1,8 @@
+#pragma once
+
+// SIMD intrinsics, where available. Code paths using them check BUBBLES_HAVE_SSE, and __AVX__ for the
+// wider ones, and fall back to scalar loops otherwise
+#if defined(__SSE__) || defined(__x86_64__)
+#include <immintrin.h>
+#define BUBBLES_HAVE_SSE 1
+#endif
@@ -4,7 +4,48 @@
 #include "vec3.h"
 #include "material.h"
 
-class Sphere : public Hittable
+/// Ray-sphere intersection in Scalar precision: nearest root in [t_min, t_max]. Uses the numerically
+/// robust form from "Ray Tracing Gems", chapter 7: the discriminant comes from the squared distance of
+/// the ray's closest approach to the center instead of b^2 - ac, which cancels badly for small spheres
+/// far away, and the nearer root is computed without subtracting nearly equal numbers
+template <typename Scalar>
+inline bool intersect_sphere(const Vec3T<Scalar> &center, Scalar radius, const RayT<Scalar> &r,
+                             Scalar t_min, Scalar t_max, Scalar *t)
+{
+  const Vec3T<Scalar> oc = r.origin() - center;
+  const Scalar a = r.direction().length_squared();
+  const Scalar half_b = dot(oc, r.direction());
+  const Scalar c = oc.length_squared() - radius * radius;
+
+  const Vec3T<Scalar> closest_approach = oc - (half_b / a) * r.direction();
+  const Scalar discriminant = a * (radius * radius - closest_approach.length_squared());
+  if (discriminant < 0)
+    return false;
+  const Scalar sqrtd = std::sqrt(discriminant);
+
+  // Roots are q / a and c / q. q is only 0 for a ray tangent at its origin (half_b and discriminant both
+  // 0), where c / q would be 0 / 0 or, after rounding in c, infinite; the one root is then q / a
+  const Scalar q = half_b > 0 ? -half_b - sqrtd : -half_b + sqrtd;
+  Scalar root0 = q / a;
+  Scalar root1 = q != 0 ? c / q : root0;
+  if (root0 > root1)
+    std::swap(root0, root1);
+
+  // Find the nearest root that lies in the acceptable range.
+  if (root0 >= t_min && root0 <= t_max)
+  {
+    *t = root0;
+    return true;
+  }
+  if (root1 >= t_min && root1 <= t_max)
+  {
+    *t = root1;
+    return true;
+  }
+  return false;
+}
+
+class Sphere final : public Hittable
 {
 public:
   Sphere() = default;
@@ -21,6 +62,23 @@ public:
   virtual bool hit(
       const Ray &r, double t_min, double t_max, hit_record *rec) const override;
 
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override;
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    double t;
+    if (!Sphere::hit_distance(r, t_min, t_max, &t))
+      return false;
+    result->t = t;
+    result->object = this;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override
+  {
+    set_attributes(r, hit.t, rec);
+  }
+
   virtual bool bounding_box(double time0, double time1, AABB *output_box) const override;
 
   // TODO add support for motion blur (these should be function of time)
@@ -34,8 +92,8 @@ public:
   double time0, time1;
   double radius;
   shared_ptr<Material> mat_ptr;
+  bool single_precision = false; // intersect in float instead of double
 
-private:
   static void get_sphere_uv(const Point3 &p, double &u, double &v)
   {
     // p: a given point on the sphere of radius one, centered at the origin.
@@ -51,39 +109,45 @@ private:
     u = phi / (2 * pi);
     v = theta / pi;
   }
+
+private:
+  /// Attributes of the hit at distance t
+  void set_attributes(const Ray &r, double t, hit_record *rec) const;
 };
 
 bool Sphere::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
 {
-  auto cur_center = center(r.time());
-
-  Vec3 oc = r.origin() - cur_center;
-  auto a = r.direction().length_squared();
-  auto half_b = dot(oc, r.direction());
-  auto c = oc.length_squared() - radius * radius;
-
-  auto discriminant = half_b * half_b - a * c;
-  if (discriminant < 0)
+  double root;
+  if (!Sphere::hit_distance(r, t_min, t_max, &root))
     return false;
-  auto sqrtd = sqrt(discriminant);
 
-  // Find the nearest root that lies in the acceptable range.
-  auto root = (-half_b - sqrtd) / a;
-  if (root < t_min || root > t_max)
-  {
-    root = (-half_b + sqrtd) / a;
-    if (root < t_min || root > t_max)
-      return false;
-  }
+  set_attributes(r, root, rec);
+  return true;
+}
 
-  rec->t = root;
+void Sphere::set_attributes(const Ray &r, double t, hit_record *rec) const
+{
+  auto cur_center = center(r.time());
+  rec->t = t;
   rec->p = r.at(rec->t);
   Vec3 outward_normal = (rec->p - cur_center) / radius;
   rec->set_face_normal(r, outward_normal);
   get_sphere_uv(outward_normal, rec->u, rec->v);
-  rec->mat_ptr = mat_ptr;
+  rec->mat_ptr = mat_ptr.get();
+}
 
-  return true;
+bool Sphere::hit_distance(const Ray &r, double t_min, double t_max, double *t) const
+{
+  const Point3 cur_center = center(r.time());
+  if (!single_precision)
+    return intersect_sphere(cur_center, radius, r, t_min, t_max, t);
+
+  // Rounding t_min, t_max to float can widen the interval slightly
+  float t_float;
+  if (!intersect_sphere(Vec3T<float>(cur_center), float(radius), RayT<float>(r), float(t_min), float(t_max), &t_float))
+    return false;
+  *t = t_float;
+  return *t >= t_min && *t <= t_max;
 }
 
 Point3 Sphere::center(double time) const
@@ -109,8 +173,7 @@ bool Sphere::bounding_box(double time0, double time1, AABB *output_box) const
 
 double Sphere::pdf_value(const Point3 &o, const Vec3 &v) const
 {
-  hit_record rec;
-  if (!this->hit(Ray(o, v), 0.001, infinity, &rec))
+  if (!this->occluded(Ray(o, v), 0.001, infinity))
     return 0;
 
   auto cos_theta_max = sqrt(1 - (radius * radius) / (center0 - o).length_squared());
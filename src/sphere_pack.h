@@ -0,0 +1,133 @@
+#pragma once
+
+#include "common.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <cstdint>
+
+/// Centers of up to Width spheres of the same radius in SoA layout, one lane per sphere, so that one
+/// sequence of SIMD instructions intersects a ray with all of them
+template <int Width>
+struct alignas(32) SpherePack
+{
+  float center[3][Width]; // x/y/z per lane
+  uint32_t id[Width];     // caller's index of each sphere
+};
+
+namespace sphere_pack
+{
+  /// Ray against the first count spheres of pack, in float. Returns bitmask of lanes hit in [t_min, t_max]
+  /// and writes each lane's nearest root in that range. Same arithmetic, in the same order, as
+  /// intersect_sphere<float>(), so results match Sphere with single_precision up to rounding where the
+  /// compiler fuses the scalar version's multiply-adds
+  template <int Width>
+  inline int intersect(const SpherePack<Width> &pack, int count, float radius, const RayT<float> &r,
+                       float t_min, float t_max, float *t)
+  {
+    // Portable version
+    int mask = 0;
+    for (int i = 0; i < count; ++i)
+    {
+      const Vec3T<float> center(pack.center[0][i], pack.center[1][i], pack.center[2][i]);
+      mask |= intersect_sphere(center, radius, r, t_min, t_max, &t[i]) << i;
+    }
+    return mask;
+  }
+
+#ifdef BUBBLES_HAVE_SSE
+  template <>
+  inline int intersect<4>(const SpherePack<4> &pack, int count, float radius, const RayT<float> &r,
+                          float t_min, float t_max, float *t_out)
+  {
+    auto select = [](__m128 mask, __m128 a, __m128 b)
+    { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); };
+    auto dot = [](const __m128 *x, const __m128 *y)
+    { return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[0], y[0]), _mm_mul_ps(x[1], y[1])), _mm_mul_ps(x[2], y[2])); };
+
+    __m128 oc[3], dir[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      oc[a] = _mm_sub_ps(_mm_set1_ps(r.origin()[a]), _mm_load_ps(pack.center[a]));
+      dir[a] = _mm_set1_ps(r.direction()[a]);
+    }
+
+    const __m128 radius_squared = _mm_set1_ps(radius * radius);
+    const __m128 a = _mm_set1_ps(r.direction().length_squared());
+    const __m128 half_b = dot(oc, dir);
+    const __m128 c = _mm_sub_ps(dot(oc, oc), radius_squared);
+
+    const __m128 s = _mm_div_ps(half_b, a);
+    __m128 closest_approach[3];
+    for (int k = 0; k < 3; ++k)
+      closest_approach[k] = _mm_sub_ps(oc[k], _mm_mul_ps(s, dir[k]));
+    const __m128 discriminant = _mm_mul_ps(a, _mm_sub_ps(radius_squared, dot(closest_approach, closest_approach)));
+    const __m128 sqrtd = _mm_sqrt_ps(discriminant);
+
+    const __m128 neg_half_b = _mm_xor_ps(half_b, _mm_set1_ps(-0.0f));
+    const __m128 q = select(_mm_cmpgt_ps(half_b, _mm_setzero_ps()), _mm_sub_ps(neg_half_b, sqrtd), _mm_add_ps(neg_half_b, sqrtd));
+    const __m128 root0 = _mm_div_ps(q, a);
+    const __m128 root1 = select(_mm_cmpeq_ps(q, _mm_setzero_ps()), root0, _mm_div_ps(c, q)); // see intersect_sphere()
+    const __m128 swap = _mm_cmpgt_ps(root0, root1);
+    const __m128 near = select(swap, root1, root0);
+    const __m128 far = select(swap, root0, root1);
+
+    const __m128 lo = _mm_set1_ps(t_min);
+    const __m128 hi = _mm_set1_ps(t_max);
+    const __m128 near_ok = _mm_and_ps(_mm_cmpge_ps(near, lo), _mm_cmple_ps(near, hi));
+    const __m128 far_ok = _mm_and_ps(_mm_cmpge_ps(far, lo), _mm_cmple_ps(far, hi));
+
+    _mm_storeu_ps(t_out, select(near_ok, near, far));
+    const __m128 hit = _mm_and_ps(_mm_cmpge_ps(discriminant, _mm_setzero_ps()), _mm_or_ps(near_ok, far_ok));
+    return _mm_movemask_ps(hit) & ((1 << count) - 1);
+  }
+#endif
+
+#ifdef __AVX__
+  template <>
+  inline int intersect<8>(const SpherePack<8> &pack, int count, float radius, const RayT<float> &r,
+                          float t_min, float t_max, float *t_out)
+  {
+    auto dot = [](const __m256 *x, const __m256 *y)
+    { return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x[0], y[0]), _mm256_mul_ps(x[1], y[1])), _mm256_mul_ps(x[2], y[2])); };
+
+    __m256 oc[3], dir[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      oc[a] = _mm256_sub_ps(_mm256_set1_ps(r.origin()[a]), _mm256_load_ps(pack.center[a]));
+      dir[a] = _mm256_set1_ps(r.direction()[a]);
+    }
+
+    const __m256 radius_squared = _mm256_set1_ps(radius * radius);
+    const __m256 a = _mm256_set1_ps(r.direction().length_squared());
+    const __m256 half_b = dot(oc, dir);
+    const __m256 c = _mm256_sub_ps(dot(oc, oc), radius_squared);
+
+    const __m256 s = _mm256_div_ps(half_b, a);
+    __m256 closest_approach[3];
+    for (int k = 0; k < 3; ++k)
+      closest_approach[k] = _mm256_sub_ps(oc[k], _mm256_mul_ps(s, dir[k]));
+    const __m256 discriminant = _mm256_mul_ps(a, _mm256_sub_ps(radius_squared, dot(closest_approach, closest_approach)));
+    const __m256 sqrtd = _mm256_sqrt_ps(discriminant);
+
+    // blendv picks its second operand where the mask is set
+    const __m256 neg_half_b = _mm256_xor_ps(half_b, _mm256_set1_ps(-0.0f));
+    const __m256 q = _mm256_blendv_ps(_mm256_add_ps(neg_half_b, sqrtd), _mm256_sub_ps(neg_half_b, sqrtd),
+                                      _mm256_cmp_ps(half_b, _mm256_setzero_ps(), _CMP_GT_OQ));
+    const __m256 root0 = _mm256_div_ps(q, a);
+    const __m256 root1 = _mm256_blendv_ps(_mm256_div_ps(c, q), root0, _mm256_cmp_ps(q, _mm256_setzero_ps(), _CMP_EQ_OQ)); // see intersect_sphere()
+    const __m256 swap = _mm256_cmp_ps(root0, root1, _CMP_GT_OQ);
+    const __m256 near = _mm256_blendv_ps(root0, root1, swap);
+    const __m256 far = _mm256_blendv_ps(root1, root0, swap);
+
+    const __m256 lo = _mm256_set1_ps(t_min);
+    const __m256 hi = _mm256_set1_ps(t_max);
+    const __m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(near, lo, _CMP_GE_OQ), _mm256_cmp_ps(near, hi, _CMP_LE_OQ));
+    const __m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(far, lo, _CMP_GE_OQ), _mm256_cmp_ps(far, hi, _CMP_LE_OQ));
+
+    _mm256_storeu_ps(t_out, _mm256_blendv_ps(far, near, near_ok));
+    const __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, _mm256_setzero_ps(), _CMP_GE_OQ), _mm256_or_ps(near_ok, far_ok));
+    return _mm256_movemask_ps(hit) & ((1 << count) - 1);
+  }
+#endif
+}
@@ -3,7 +3,9 @@
 #include "common.h"
 #include "rtw_stb_image.h"
 
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 class Texture
 {
@@ -12,7 +14,7 @@ public:
   virtual ~Texture() = default;
 };
 
-class SolidColor : public Texture
+class SolidColor final : public Texture
 {
 public:
   SolidColor() {}
@@ -26,11 +28,13 @@ public:
     return color_value;
   }
 
+  const Color &color() const { return color_value; }
+
 private:
   Color color_value;
 };
 
-class CheckerTexture : public Texture
+class CheckerTexture final : public Texture
 {
 public:
   CheckerTexture() {}
@@ -43,20 +47,29 @@ public:
 
   virtual Color value(double u, double v, const Point3 &p) const override
   {
-    static constexpr double phase = 10.0;
-    auto sines = sin(phase * p.x()) * sin(phase * p.y()) * sin(phase * p.z());
-    if (sines < 0)
+    if (odd_cell(p))
       return odd->value(u, v, p);
     else
       return even->value(u, v, p);
   }
 
+  /// Whether sin(10 x) sin(10 y) sin(10 z) < 0 at p. Each sine is negative on odd half-periods, so the
+  /// product is negative iff the half-period indices add up to an odd number; no sin() calls needed
+  static bool odd_cell(const Point3 &p)
+  {
+    const double half_periods_per_unit = 10.0 / pi;
+    const int64_t cell = static_cast<int64_t>(floor(p.x() * half_periods_per_unit)) +
+                         static_cast<int64_t>(floor(p.y() * half_periods_per_unit)) +
+                         static_cast<int64_t>(floor(p.z() * half_periods_per_unit));
+    return cell & 1;
+  }
+
 public:
   shared_ptr<Texture> even;
   shared_ptr<Texture> odd;
 };
 
-class ImageTexture : public Texture
+class ImageTexture final : public Texture
 {
 public:
   static const int bytes_per_pixel = 3; // unsigned char (1 byte) x3 for RGB
@@ -114,4 +127,84 @@ private:
   unsigned char *data;
   int width, height;
   int bytes_per_scanline;
-};
\ No newline at end of file
+};
+
+/// Texture tree (e.g. a CheckerTexture of two other textures) flattened into one array, node 0 being
+/// the root. value() walks it with a switch on each node's type, so built-in textures are evaluated
+/// without virtual calls or shared_ptr indirections; other Texture subclasses are called virtually.
+/// Holds on to the original tree, whose image data the nodes point into
+class TextureGraph
+{
+public:
+  enum class NodeType : uint8_t
+  {
+    solid,
+    checker,
+    image,
+    other
+  };
+
+  struct Node
+  {
+    NodeType type;
+    uint32_t even, odd;     // children of a checker node
+    Color color;            // of a solid node
+    const Texture *texture; // of an image or other node
+  };
+
+  TextureGraph() : TextureGraph(Color(0, 0, 0)) {}
+  TextureGraph(const Color &c) : nodes{Node{NodeType::solid, 0, 0, c, nullptr}} {}
+  TextureGraph(shared_ptr<Texture> root) : source(root) { add(root.get()); }
+
+  Color value(double u, double v, const Point3 &p) const
+  {
+    uint32_t i = 0;
+    while (true)
+    {
+      const Node &node = nodes[i];
+      switch (node.type)
+      {
+      case NodeType::solid:
+        return node.color;
+      case NodeType::checker:
+        i = CheckerTexture::odd_cell(p) ? node.odd : node.even;
+        break;
+      case NodeType::image:
+        return static_cast<const ImageTexture *>(node.texture)->value(u, v, p);
+      default:
+        return node.texture->value(u, v, p);
+      }
+    }
+  }
+
+public:
+  std::vector<Node> nodes;
+
+private:
+  shared_ptr<Texture> source;
+
+  uint32_t add(const Texture *texture)
+  {
+    const uint32_t i = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node{NodeType::other, 0, 0, Color(0, 0, 0), texture});
+    if (const auto *solid = dynamic_cast<const SolidColor *>(texture))
+    {
+      nodes[i].type = NodeType::solid;
+      nodes[i].color = solid->color();
+    }
+    else if (const auto *checker = dynamic_cast<const CheckerTexture *>(texture))
+    {
+      // Adding children can reallocate nodes, so index it again afterwards
+      const uint32_t even = add(checker->even.get());
+      const uint32_t odd = add(checker->odd.get());
+      nodes[i].type = NodeType::checker;
+      nodes[i].even = even;
+      nodes[i].odd = odd;
+    }
+    else if (dynamic_cast<const ImageTexture *>(texture))
+    {
+      nodes[i].type = NodeType::image;
+    }
+    return i;
+  }
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/// Rectangular block of pixels: rows [row0, row1), cols [col0, col1)
+struct Tile
+{
+  int row0, row1;
+  int col0, col1;
+};
+
+/// Order in which tiles are handed out to render threads
+enum class TileOrder
+{
+  Scanline, // row by row, like the old static split
+  Morton,   // Z-order curve; neighboring tiles stay close together in time, which is friendlier to caches
+  Spiral    // outwards from image center, where the interesting (expensive) part of a scene usually is
+};
+
+inline uint32_t morton_code_2d(uint32_t x, uint32_t y)
+{
+  // Interleave bits of x and y: http://graphics.stanford.edu/~seander/bithacks.html#InterleaveBMN
+  auto spread_bits = [](uint32_t v)
+  {
+    v &= 0x0000ffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+  return spread_bits(x) | (spread_bits(y) << 1);
+}
+
+/// Split HxW image into tiles of (at most) tile_size x tile_size pixels, listed in the given order
+inline std::vector<Tile> make_tiles(int H, int W, int tile_size, TileOrder order)
+{
+  assert(tile_size > 0);
+
+  const int tiles_y = (H + tile_size - 1) / tile_size;
+  const int tiles_x = (W + tile_size - 1) / tile_size;
+
+  struct TileKey
+  {
+    Tile tile;
+    double key;
+  };
+  std::vector<TileKey> keyed;
+  keyed.reserve(tiles_x * tiles_y);
+
+  const double center_x = 0.5 * (tiles_x - 1);
+  const double center_y = 0.5 * (tiles_y - 1);
+
+  for (int ty = 0; ty < tiles_y; ++ty)
+  {
+    for (int tx = 0; tx < tiles_x; ++tx)
+    {
+      Tile t{ty * tile_size, std::min(H, (ty + 1) * tile_size),
+             tx * tile_size, std::min(W, (tx + 1) * tile_size)};
+
+      double key = 0;
+      switch (order)
+      {
+      case TileOrder::Scanline:
+        key = ty * tiles_x + tx;
+        break;
+      case TileOrder::Morton:
+        key = morton_code_2d(tx, ty);
+        break;
+      case TileOrder::Spiral:
+      {
+        // Sort by square "ring" around center first, then by angle within ring
+        const double dx = tx - center_x;
+        const double dy = ty - center_y;
+        const double ring = std::ceil(std::max(std::fabs(dx), std::fabs(dy)));
+        const double angle = std::atan2(dy, dx) + pi; // [0, 2pi]
+        key = ring * 8 + angle;
+        break;
+      }
+      }
+      keyed.push_back({t, key});
+    }
+  }
+
+  std::stable_sort(keyed.begin(), keyed.end(), [](const TileKey &a, const TileKey &b)
+                   { return a.key < b.key; });
+
+  std::vector<Tile> tiles;
+  tiles.reserve(keyed.size());
+  for (const auto &k : keyed)
+    tiles.push_back(k.tile);
+  return tiles;
+}
+
+/// Work-stealing tile queue. Tiles are dealt round-robin to per-worker queues, so that each worker
+/// starts on its own share of the traversal order. Workers take from the front of their own queue,
+/// and once that is empty, steal from the back of other workers' queues. Locks are per-queue and
+/// only taken once per tile, so they are never contended within the per-pixel loop.
+class TileScheduler
+{
+public:
+  TileScheduler(const std::vector<Tile> &tiles, int num_workers) : queues(std::max(1, num_workers))
+  {
+    for (size_t i = 0; i < tiles.size(); ++i)
+      queues[i % queues.size()].tiles.push_back(tiles[i]);
+  }
+
+  /// Get next tile for given worker. Returns false once there is no work left anywhere
+  bool next(int worker, Tile *tile)
+  {
+    {
+      auto &own = queues[worker];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tiles.empty())
+      {
+        *tile = own.tiles.front();
+        own.tiles.pop_front();
+        return true;
+      }
+    }
+
+    // Own queue is empty; steal from the others, starting with our neighbor
+    const int num_workers = queues.size();
+    for (int offset = 1; offset < num_workers; ++offset)
+    {
+      auto &victim = queues[(worker + offset) % num_workers];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tiles.empty())
+      {
+        *tile = victim.tiles.back();
+        victim.tiles.pop_back();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+private:
+  struct WorkerQueue
+  {
+    std::mutex mutex;
+    std::deque<Tile> tiles;
+  };
+
+  std::vector<WorkerQueue> queues;
+};
@@ -5,6 +5,8 @@
 #include <mutex>
 #include <string>
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace timing
 {
@@ -31,23 +33,63 @@ namespace timing
     double num;
   };
 
-  inline std::map<std::string, TimingData> &data_instance()
+  using TimingMap = std::map<std::string, TimingData>;
+
+  // Timers are stopped from every render thread, many times per pixel, so each thread records into
+  // its own map. The per-thread mutex is only ever contended while print() runs.
+  struct ThreadTimingData
   {
-    static std::map<std::string, TimingData> data;
-    return data;
-  }
+    std::mutex mut;
+    TimingMap data;
+  };
 
-  inline std::mutex &mutex_instance()
+  inline std::mutex &registry_mutex_instance()
   {
     static std::mutex mut;
     return mut;
   }
 
+  inline std::vector<std::shared_ptr<ThreadTimingData> > &registry_instance()
+  {
+    // Owned by registry, so that data survives after the recording thread exits
+    static std::vector<std::shared_ptr<ThreadTimingData> > registry;
+    return registry;
+  }
+
+  inline ThreadTimingData &thread_data_instance()
+  {
+    thread_local std::shared_ptr<ThreadTimingData> data = []()
+    {
+      auto d = std::make_shared<ThreadTimingData>();
+      std::lock_guard<std::mutex> lock(registry_mutex_instance());
+      registry_instance().push_back(d);
+      return d;
+    }();
+    return *data;
+  }
+
+  /// Merge timing data over all threads
+  inline TimingMap collect()
+  {
+    TimingMap merged;
+    std::lock_guard<std::mutex> registry_lock(registry_mutex_instance());
+    for (const auto &thread_data : registry_instance())
+    {
+      std::lock_guard<std::mutex> lock(thread_data->mut);
+      for (const auto &kv_pair : thread_data->data)
+      {
+        merged[kv_pair.first].total_time += kv_pair.second.total_time;
+        merged[kv_pair.first].num += kv_pair.second.num;
+      }
+    }
+    return merged;
+  }
+
   inline void print(std::ostream &out)
   {
     out << "Timing data:" << std::endl;
 
-    for (const auto &kv_pair : data_instance())
+    for (const auto &kv_pair : collect())
     {
       const auto &tag = kv_pair.first;
       const auto &data = kv_pair.second;
@@ -76,9 +118,10 @@ namespace timing
       double elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - t_start_).count() * 1e-6;
       active_ = false;
 
-      std::lock_guard<std::mutex> lock(mutex_instance());
-      data_instance()[tag_].total_time += elapsed;
-      data_instance()[tag_].num++;
+      auto &thread_data = thread_data_instance();
+      std::lock_guard<std::mutex> lock(thread_data.mut);
+      thread_data.data[tag_].total_time += elapsed;
+      thread_data.data[tag_].num++;
     }
 
   private:
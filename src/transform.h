@@ -0,0 +1,288 @@
+#pragma once
+
+#include "aabb.h"
+#include "common.h"
+#include "hittable.h"
+
+#include <cmath>
+#include <initializer_list>
+
+/// Affine transform x -> A x + b, with A a general 3x3 matrix (rotation, scale, shear, ...)
+class Affine3
+{
+public:
+  Affine3() : Affine3(identity()) {}
+
+  static Affine3 identity()
+  {
+    return Affine3({1, 0, 0, 0, 1, 0, 0, 0, 1}, Vec3(0, 0, 0));
+  }
+
+  static Affine3 translation(const Vec3 &offset)
+  {
+    return Affine3({1, 0, 0, 0, 1, 0, 0, 0, 1}, offset);
+  }
+
+  static Affine3 scaling(const Vec3 &scale)
+  {
+    return Affine3({scale.x(), 0, 0, 0, scale.y(), 0, 0, 0, scale.z()}, Vec3(0, 0, 0));
+  }
+
+  static Affine3 scaling(double scale) { return scaling(Vec3(scale, scale, scale)); }
+
+  /// Rotation about an axis through the origin; counterclockwise when looking down the axis
+  static Affine3 rotation(const Vec3 &axis, double angle_degrees)
+  {
+    const Vec3 k = unit_vector(axis);
+    const double c = cos(degrees_to_radians(angle_degrees));
+    const double s = sin(degrees_to_radians(angle_degrees));
+    const double ic = 1 - c;
+
+    // Rodrigues' rotation formula in matrix form
+    return Affine3({c + k.x() * k.x() * ic, k.x() * k.y() * ic - k.z() * s, k.x() * k.z() * ic + k.y() * s,
+                    k.y() * k.x() * ic + k.z() * s, c + k.y() * k.y() * ic, k.y() * k.z() * ic - k.x() * s,
+                    k.z() * k.x() * ic - k.y() * s, k.z() * k.y() * ic + k.x() * s, c + k.z() * k.z() * ic},
+                   Vec3(0, 0, 0));
+  }
+
+  Point3 apply_point(const Point3 &p) const { return apply_vector(p) + offset; }
+
+  Vec3 apply_vector(const Vec3 &v) const
+  {
+    return Vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+  }
+
+  /// Multiply by transpose of the linear part. Normals transform with the inverse transpose, so the
+  /// inverse transform's apply_transposed() maps normals forward
+  Vec3 apply_transposed(const Vec3 &v) const
+  {
+    return Vec3(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2],
+                m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+                m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+  }
+
+  double determinant() const
+  {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  /// Whether the linear part is a rotation (orthonormal, no reflection), up to rounding
+  bool is_rotation() const
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        const double row_dot = m[i][0] * m[j][0] + m[i][1] * m[j][1] + m[i][2] * m[j][2];
+        if (std::abs(row_dot - (i == j ? 1 : 0)) > 1e-12)
+          return false;
+      }
+    }
+    return determinant() > 0;
+  }
+
+  Affine3 inverse() const
+  {
+    const double inv_det = 1.0 / determinant();
+    Affine3 inv;
+    // Adjugate: transposed cofactors
+    for (int i = 0; i < 3; ++i)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        const int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+        const int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+        inv.m[i][j] = (m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0]) * inv_det;
+      }
+    }
+    inv.offset = -inv.apply_vector(offset);
+    return inv;
+  }
+
+  /// Transformed bounds of box: bounds of all 8 transformed corners
+  AABB apply_box(const AABB &box) const
+  {
+    Point3 min(infinity, infinity, infinity);
+    Point3 max(-infinity, -infinity, -infinity);
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      const Point3 p(corner & 1 ? box.max().x() : box.min().x(),
+                     corner & 2 ? box.max().y() : box.min().y(),
+                     corner & 4 ? box.max().z() : box.min().z());
+      const Point3 q = apply_point(p);
+      for (int a = 0; a < 3; ++a)
+      {
+        min[a] = fmin(min[a], q[a]);
+        max[a] = fmax(max[a], q[a]);
+      }
+    }
+    return AABB(min, max);
+  }
+
+public:
+  double m[3][3]; // linear part, row-major
+  Vec3 offset;    // translation
+
+private:
+  Affine3(std::initializer_list<double> rows, const Vec3 &b) : offset(b)
+  {
+    auto it = rows.begin();
+    for (int i = 0; i < 3; ++i)
+      for (int j = 0; j < 3; ++j)
+        m[i][j] = *it++;
+  }
+};
+
+/// Composition: (a * b) applies b first, then a
+inline Affine3 operator*(const Affine3 &a, const Affine3 &b)
+{
+  Affine3 ab;
+  for (int i = 0; i < 3; ++i)
+    for (int j = 0; j < 3; ++j)
+      ab.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+  ab.offset = a.apply_point(b.offset);
+  return ab;
+}
+
+/// Object placed in the world with an arbitrary affine transform. Many Transforms can share the same
+/// object, e.g. a mesh with its own BVH: that's instancing, where the geometry and its (bottom-level)
+/// BVH exist only once. A LinearBVH over the instances is then the top-level BVH.
+///
+/// Rays are transformed into object space instead of the object into world space. The object-space ray
+/// direction isn't normalized, so hit distances t are the same in both spaces.
+///
+/// Transforms of Transforms are folded into one on construction: ptr is never itself a Transform, so a
+/// chain like Translate(RotateY(FlipFace(p))) costs one ray transform and one virtual call per ray.
+class Transform : public Hittable
+{
+public:
+  /// With flip_faces, the side of the surface that counts as its front is swapped, e.g. so that a light
+  /// only emits towards the other side
+  Transform(shared_ptr<Hittable> p, const Affine3 &object_to_world, bool flip_faces = false)
+      : ptr(p), to_world(object_to_world), flip_faces(flip_faces)
+  {
+    if (auto inner = std::dynamic_pointer_cast<Transform>(p))
+    {
+      ptr = inner->ptr;
+      to_world = object_to_world * inner->to_world;
+      this->flip_faces = flip_faces != inner->flip_faces;
+    }
+    to_object = to_world.inverse();
+    rigid = to_world.is_rotation();
+  }
+
+  virtual bool hit(
+      const Ray &r, double t_min, double t_max, hit_record *rec) const override;
+
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    return ptr->hit_distance(to_object_space(r), t_min, t_max, t);
+  }
+
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override
+  {
+    return ptr->occluded(to_object_space(r), t_min, t_max);
+  }
+
+  /// Transformed bounds of the object over [time0, time1], so that BVHs see an instanced moving object
+  /// move too. The transform is affine, so the interpolation of the transformed bounds at two times
+  /// contains the transformed bounds at any time in between
+  virtual bool bounding_box(double time0, double time1, AABB *output_box) const override
+  {
+    AABB object_box;
+    if (!ptr->bounding_box(time0, time1, &object_box))
+      return false;
+    *output_box = to_world.apply_box(object_box);
+    return true;
+  }
+
+  virtual double pdf_value(const Point3 &o, const Vec3 &v) const override;
+  virtual Vec3 random(const Point3 &o) const override;
+
+public:
+  shared_ptr<Hittable> ptr;
+  Affine3 to_world;
+  Affine3 to_object;
+  bool flip_faces;
+  bool rigid; // only rotates and translates, so normals transform like directions and keep their length
+
+private:
+  Ray to_object_space(const Ray &r) const
+  {
+    return Ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+  }
+};
+
+bool Transform::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
+{
+  const Ray object_r = to_object_space(r);
+  if (!ptr->hit(object_r, t_min, t_max, rec))
+    return false;
+
+  const Vec3 outward_normal = rec->front_face ? rec->normal : -rec->normal;
+  rec->p = to_world.apply_point(rec->p);
+  rec->set_face_normal(r, rigid ? to_world.apply_vector(outward_normal)
+                                : unit_vector(to_object.apply_transposed(outward_normal)));
+  if (flip_faces)
+    rec->front_face = !rec->front_face;
+
+  return true;
+}
+
+double Transform::pdf_value(const Point3 &o, const Vec3 &v) const
+{
+  // Object-space pdf is per object-space solid angle. Directions map through the linear part L of
+  // to_object, with d(omega_object) / d(omega_world) = |det L| / |L v|^3 for unit v
+  const Vec3 object_v = to_object.apply_vector(unit_vector(v));
+  const double length = object_v.length();
+  const double jacobian = fabs(to_object.determinant()) / (length * length * length);
+
+  return ptr->pdf_value(to_object.apply_point(o), object_v) * jacobian;
+}
+
+Vec3 Transform::random(const Point3 &o) const
+{
+  return to_world.apply_vector(ptr->random(to_object.apply_point(o)));
+}
+
+// Shorthands for common transforms. Being Transforms, nested ones fold into a single transform
+
+class Translate : public Transform
+{
+public:
+  Translate(shared_ptr<Hittable> p, const Vec3 &displacement)
+      : Transform(p, Affine3::translation(displacement)) {}
+};
+
+/// Rotate about an axis through the origin
+class Rotate : public Transform
+{
+public:
+  Rotate(shared_ptr<Hittable> p, const Vec3 &axis, double angle_degrees)
+      : Transform(p, Affine3::rotation(axis, angle_degrees)) {}
+};
+
+class RotateY : public Transform
+{
+public:
+  RotateY(shared_ptr<Hittable> p, double angle_degrees)
+      : Transform(p, Affine3::rotation(Vec3(0, 1, 0), angle_degrees)) {}
+};
+
+/// Scale about the origin
+class Scale : public Transform
+{
+public:
+  Scale(shared_ptr<Hittable> p, const Vec3 &scale) : Transform(p, Affine3::scaling(scale)) {}
+  Scale(shared_ptr<Hittable> p, double scale) : Transform(p, Affine3::scaling(scale)) {}
+};
+
+class FlipFace : public Transform
+{
+public:
+  FlipFace(shared_ptr<Hittable> p) : Transform(p, Affine3::identity(), /* flip_faces */ true) {}
+};
@@ -4,9 +4,49 @@
 #include "hittable.h"
 #include "material.h"
 
+#include <algorithm>
 #include <array>
 
-class Triangle : public Hittable
+/// Moller-Trumbore ray-triangle intersection, for triangle with vertex v0 and edges v0v1, v0v2, in Scalar
+/// precision. Sets distance and barycentric coordinates of the hit
+template <typename Scalar>
+inline bool intersect_triangle(const Vec3T<Scalar> &v0, const Vec3T<Scalar> &v0v1, const Vec3T<Scalar> &v0v2,
+                               const RayT<Scalar> &r, Scalar t_min, Scalar t_max, Scalar *t_out, Scalar *u_out, Scalar *v_out)
+{
+  // https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
+  const Vec3T<Scalar> pvec = cross(r.direction(), v0v2);
+  const Scalar det = dot(v0v1, pvec);
+
+  // Ray and triangle are parallel if det is 0. det scales with the edge lengths, so any fixed epsilon
+  // would reject all hits on small enough triangles (e.g. 1e-6 is an edge length of ~1e-3, in a dense
+  // mesh of unit size). Nearly parallel rays need no special case: u, v come out huge and get rejected.
+  // note: if the determinant is negative the triangle is backfacing
+  if (det == 0)
+    return false;
+
+  const Scalar inv_det = 1 / det;
+
+  const Vec3T<Scalar> tvec = r.origin() - v0;
+  const Scalar u = dot(tvec, pvec) * inv_det;
+  if (u < 0 || u > 1)
+    return false;
+
+  const Vec3T<Scalar> qvec = cross(tvec, v0v1);
+  const Scalar v = dot(r.direction(), qvec) * inv_det;
+  if (v < 0 || u + v > 1)
+    return false;
+
+  const Scalar t = dot(v0v2, qvec) * inv_det;
+  if (t < t_min || t > t_max)
+    return false;
+
+  *t_out = t;
+  *u_out = u;
+  *v_out = v;
+  return true;
+}
+
+class Triangle final : public Hittable
 {
 public:
   using Vertices = std::array<Point3, 3>;
@@ -18,12 +58,35 @@ public:
     v0v2 = verts[2] - verts[0];
     area = 0.5 * cross(v0v1, v0v2).length();
 
-    front_normal = cross(v0v1, v0v2); // follow obj convention; vertices defined CCW
+    front_normal = unit_vector(cross(v0v1, v0v2)); // follow obj convention; vertices defined CCW
   };
 
   virtual bool hit(
       const Ray &r, double t_min, double t_max, hit_record *rec) const override;
 
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    double u, v;
+    return intersect(r, t_min, t_max, t, &u, &v);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    double t, u, v;
+    if (!intersect(r, t_min, t_max, &t, &u, &v))
+      return false;
+    result->t = t;
+    result->object = this;
+    result->u = u;
+    result->v = v;
+    return true;
+  }
+
+  virtual void surface_attributes(const Ray &r, const surface_hit &hit, hit_record *rec) const override
+  {
+    set_attributes(r, hit.t, hit.u, hit.v, rec);
+  }
+
   virtual bool bounding_box(double time0, double time1, AABB *output_box) const override;
 
   virtual double pdf_value(const Point3 &o, const Vec3 &v) const override;
@@ -38,44 +101,36 @@ private:
   Vec3 v0v1;
   Vec3 v0v2;
   double area;
+
+  /// Distance and barycentric coordinates of hit
+  bool intersect(const Ray &r, double t_min, double t_max, double *t, double *u, double *v) const;
+
+  void set_attributes(const Ray &r, double t, double u, double v, hit_record *rec) const
+  {
+    rec->t = t;
+    rec->p = r.at(rec->t);
+    rec->set_face_normal(r, front_normal);
+    rec->u = u;
+    rec->v = v;
+    rec->mat_ptr = mat_ptr.get();
+  }
 };
 
 bool Triangle::hit(const Ray &r, double t_min, double t_max, hit_record *rec) const
 {
-  // Moller-Trumbore algorithm: https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/moller-trumbore-ray-triangle-intersection
-  const Vec3 pvec = cross(r.direction(), v0v2);
-  const double det = dot(v0v1, pvec);
-
-  // ray and triangle are parallel if det is close to 0
-  // note: if the determinant is negative the triangle is backfacing
-  if (std::abs(det) < 1e-6)
+  double t, u, v;
+  if (!intersect(r, t_min, t_max, &t, &u, &v))
     return false;
 
-  const double inv_det = 1 / det;
-
-  const Vec3 tvec = r.origin() - verts[0];
-  const double u = dot(tvec, pvec) * inv_det;
-  if (u < 0 || u > 1)
-    return false;
-
-  const Vec3 qvec = cross(tvec, v0v1);
-  const double v = dot(r.direction(), qvec) * inv_det;
-  if (v < 0 || u + v > 1)
-    return false;
-
-  const double t = dot(v0v2, qvec) * inv_det;
-  if (t < t_min || t > t_max)
-    return false;
-
-  rec->t = t;
-  rec->p = r.at(rec->t);
-  rec->set_face_normal(r, front_normal);
-  rec->u = u;
-  rec->v = v;
-  rec->mat_ptr = mat_ptr;
+  set_attributes(r, t, u, v, rec);
   return true;
 }
 
+bool Triangle::intersect(const Ray &r, double t_min, double t_max, double *t, double *u, double *v) const
+{
+  return intersect_triangle(verts[0], v0v1, v0v2, r, t_min, t_max, t, u, v);
+}
+
 bool Triangle::bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const
 {
   Point3 lb(std::min({verts[0].x(), verts[1].x(), verts[2].x()}),
@@ -93,13 +148,13 @@ bool Triangle::bounding_box(double /*time0*/, double /*time1*/, AABB *output_box
 
 double Triangle::pdf_value(const Point3 &o, const Vec3 &v) const
 {
-  hit_record rec;
-  if (!this->hit(Ray(o, v), 0.001, infinity, &rec))
+  double t;
+  if (!this->hit_distance(Ray(o, v), 0.001, infinity, &t))
     return 0;
 
-  // Use AARect's solid angle math. Not sure if this is correct
-  auto distance_squared = rec.t * rec.t * v.length_squared();
-  auto cosine = fabs(dot(v, rec.normal) / v.length());
+  // Same solid angle math as AARect
+  auto distance_squared = t * t * v.length_squared();
+  auto cosine = fabs(dot(v, front_normal) / v.length());
 
   const double solid_angle = area * cosine / distance_squared;
   const double pdf_val = 1 / solid_angle;
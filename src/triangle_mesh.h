@@ -4,19 +4,19 @@
 #include "common.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "mesh.h"
+#include "mesh_cache.h"
 #include "triangle.h"
 #include "timing.h"
 
 #include "external/tinyobjloader.h"
 
-// TODO implement Hittable class that:
-// * supports translation/rotation/scaling of mesh
-// * wraps BVH, provides importance sampling
-// * doesn't duplicate vertices (see PBRT)
+// TODO TriangleMesh importance sampling
 
-shared_ptr<BVHNode> import_triangle_mesh(const std::string &mesh_file, shared_ptr<Material> mat_ptr)
+/// Load vertices and faces of an obj file
+MeshData load_mesh_data(const std::string &mesh_file)
 {
-  timing::Timer timer("import_triangle_mesh");
+  timing::Timer timer("load_mesh_data");
 
   tinyobj::ObjReader reader;
   if (!reader.ParseFromFile(mesh_file, tinyobj::ObjReaderConfig()))
@@ -33,8 +33,8 @@ shared_ptr<BVHNode> import_triangle_mesh(const std::string &mesh_file, shared_pt
   const auto &shapes = reader.GetShapes();
   const auto &attrib = reader.GetAttrib();
 
-  HittableList triangles;
-  Triangle::Vertices tri_verts;
+  MeshData mesh;
+  mesh.vertices.assign(attrib.vertices.begin(), attrib.vertices.end());
 
   for (size_t s = 0; s < shapes.size(); s++)
   {
@@ -50,19 +50,76 @@ shared_ptr<BVHNode> import_triangle_mesh(const std::string &mesh_file, shared_pt
 
       // Loop over vertices in the face.
       for (size_t v = 0; v < num_vertices; v++)
-      {
-        tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-        tinyobj::real_t vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-        tinyobj::real_t vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-        tinyobj::real_t vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-        tri_verts[v] = Point3(vx, vy, vz);
-      }
+        mesh.indices.push_back(shapes[s].mesh.indices[index_offset + v].vertex_index);
 
       index_offset += num_vertices;
-      triangles.add(make_shared<Triangle>(tri_verts, mat_ptr));
     }
   }
 
+  return mesh;
+}
+
+/// One Triangle per face of an indexed mesh
+std::vector<shared_ptr<Hittable> > make_triangles(const float *vertices, const uint32_t *indices, size_t num_triangles, shared_ptr<Material> mat_ptr)
+{
+  std::vector<shared_ptr<Hittable> > triangles;
+  triangles.reserve(num_triangles);
+  Triangle::Vertices tri_verts;
+  for (size_t f = 0; f < num_triangles; ++f)
+  {
+    for (int v = 0; v < 3; ++v)
+    {
+      const float *vertex = vertices + 3 * size_t(indices[3 * f + v]);
+      tri_verts[v] = Point3(vertex[0], vertex[1], vertex[2]);
+    }
+    triangles.push_back(make_shared<Triangle>(tri_verts, mat_ptr));
+  }
+  return triangles;
+}
+
+/// Load all faces of an obj file as individual triangles
+HittableList load_triangles(const std::string &mesh_file, shared_ptr<Material> mat_ptr)
+{
+  timing::Timer timer("load_triangles");
+  const MeshData mesh = load_mesh_data(mesh_file);
+
+  HittableList triangles;
+  triangles.objects = make_triangles(mesh.vertices.data(), mesh.indices.data(), mesh.indices.size() / 3, mat_ptr);
+  return triangles;
+}
+
+/// Mesh with its BVH. If mesh_cache::directory is set, the mesh and its BVH are loaded from the mesh's cache
+/// file there if that is up to date (see mesh_cache), and the cache is written after parsing and building
+/// otherwise. Cached vertices, indices and BVH nodes are used straight from the mapped file.
+shared_ptr<TriangleMesh> import_triangle_mesh(const std::string &mesh_file, shared_ptr<Material> mat_ptr,
+                                              const BVHBuildOptions &bvh_opts = BVHBuildOptions())
+{
+  timing::Timer timer("import_triangle_mesh");
+  const bool use_cache = !mesh_cache::directory.empty();
+  const std::string cache_file = use_cache ? mesh_cache::cache_file(mesh_file) : "";
+
+  mesh_cache::View cache;
+  if (use_cache && mesh_cache::load(cache_file, mesh_file, bvh_opts, &cache))
+  {
+    const auto &header = *cache.header;
+    const AABB box(Point3(header.box_min[0], header.box_min[1], header.box_min[2]),
+                   Point3(header.box_max[0], header.box_max[1], header.box_max[2]));
+    return make_shared<TriangleMesh>(cache.vertices, header.num_vertices, cache.indices, header.num_triangles,
+                                     cache.nodes, header.num_nodes, box, mat_ptr, cache.file);
+  }
+
+  MeshData mesh_data = load_mesh_data(mesh_file);
+
   timing::Timer bvh_timer("import_triangle_mesh/bvh");
-  return make_shared<BVHNode>(triangles, /*t0*/ 0, /*t1*/ 1);
-}
\ No newline at end of file
+  auto mesh = make_shared<TriangleMesh>(std::move(mesh_data), mat_ptr, bvh_opts);
+  bvh_timer.stop();
+
+  if (use_cache)
+  {
+    mkdir(mesh_cache::directory.c_str(), 0755); // fails harmlessly if it exists
+    if (!mesh_cache::save(cache_file, mesh_file, bvh_opts, *mesh))
+      std::cerr << "Could not write mesh cache " << cache_file << std::endl;
+  }
+
+  return mesh;
+}
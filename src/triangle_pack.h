@@ -0,0 +1,136 @@
+#pragma once
+
+#include "common.h"
+#include "simd.h"
+#include "triangle.h"
+
+#include <cstdint>
+
+/// Vertices of up to Width triangles in SoA layout: one lane per triangle, so that one sequence of SIMD
+/// instructions intersects a ray with all of them. Unused lanes are all zeros, which makes them degenerate
+/// (det == 0), so they never report a hit
+template <int Width>
+struct alignas(16) TrianglePack
+{
+  float v0[3][Width]; // x/y/z per lane
+  float v1[3][Width];
+  float v2[3][Width];
+};
+
+namespace triangle_pack
+{
+  /// Moller-Trumbore against all triangles of pack in Scalar precision. Returns bitmask of lanes hit in
+  /// [t_min, t_max], and writes each lane's distance and barycentric coordinates. Same arithmetic, in the
+  /// same order, as intersect_triangle(), so results match Triangle exactly
+  template <typename Scalar, int Width>
+  inline int intersect(const TrianglePack<Width> &pack, const RayT<Scalar> &r, Scalar t_min, Scalar t_max,
+                       Scalar *t, Scalar *u, Scalar *v)
+  {
+    // Portable version
+    int mask = 0;
+    for (int i = 0; i < Width; ++i)
+    {
+      const Vec3T<Scalar> v0(pack.v0[0][i], pack.v0[1][i], pack.v0[2][i]);
+      const Vec3T<Scalar> v1(pack.v1[0][i], pack.v1[1][i], pack.v1[2][i]);
+      const Vec3T<Scalar> v2(pack.v2[0][i], pack.v2[1][i], pack.v2[2][i]);
+      mask |= intersect_triangle(v0, v1 - v0, v2 - v0, r, t_min, t_max, &t[i], &u[i], &v[i]) << i;
+    }
+    return mask;
+  }
+
+#ifdef BUBBLES_HAVE_SSE
+  template <>
+  inline int intersect<float, 4>(const TrianglePack<4> &pack, const RayT<float> &r, float t_min, float t_max,
+                                 float *t_out, float *u_out, float *v_out)
+  {
+    __m128 v0[3], e1[3], e2[3], dir[3], tvec[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      v0[a] = _mm_load_ps(pack.v0[a]);
+      e1[a] = _mm_sub_ps(_mm_load_ps(pack.v1[a]), v0[a]);
+      e2[a] = _mm_sub_ps(_mm_load_ps(pack.v2[a]), v0[a]);
+      dir[a] = _mm_set1_ps(r.direction()[a]);
+      tvec[a] = _mm_sub_ps(_mm_set1_ps(r.origin()[a]), v0[a]);
+    }
+
+    auto cross = [](const __m128 *x, const __m128 *y, __m128 *out)
+    {
+      out[0] = _mm_sub_ps(_mm_mul_ps(x[1], y[2]), _mm_mul_ps(x[2], y[1]));
+      out[1] = _mm_sub_ps(_mm_mul_ps(x[2], y[0]), _mm_mul_ps(x[0], y[2]));
+      out[2] = _mm_sub_ps(_mm_mul_ps(x[0], y[1]), _mm_mul_ps(x[1], y[0]));
+    };
+    auto dot = [](const __m128 *x, const __m128 *y)
+    { return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x[0], y[0]), _mm_mul_ps(x[1], y[1])), _mm_mul_ps(x[2], y[2])); };
+
+    __m128 pvec[3], qvec[3];
+    cross(dir, e2, pvec);
+    const __m128 det = dot(e1, pvec);
+    const __m128 inv_det = _mm_div_ps(_mm_set1_ps(1), det);
+    const __m128 u = _mm_mul_ps(dot(tvec, pvec), inv_det);
+    cross(tvec, e1, qvec);
+    const __m128 v = _mm_mul_ps(dot(dir, qvec), inv_det);
+    const __m128 t = _mm_mul_ps(dot(e2, qvec), inv_det);
+
+    // Ordered comparisons are false for NaN, e.g. from degenerate lanes
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1);
+    __m128 hit = _mm_cmpneq_ps(det, zero);
+    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+    hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(t_min)), _mm_cmple_ps(t, _mm_set1_ps(t_max))));
+
+    _mm_storeu_ps(t_out, t);
+    _mm_storeu_ps(u_out, u);
+    _mm_storeu_ps(v_out, v);
+    return _mm_movemask_ps(hit);
+  }
+#endif
+
+#ifdef __AVX__
+  template <>
+  inline int intersect<double, 4>(const TrianglePack<4> &pack, const RayT<double> &r, double t_min, double t_max,
+                                  double *t_out, double *u_out, double *v_out)
+  {
+    __m256d v0[3], e1[3], e2[3], dir[3], tvec[3];
+    for (int a = 0; a < 3; ++a)
+    {
+      v0[a] = _mm256_cvtps_pd(_mm_load_ps(pack.v0[a]));
+      e1[a] = _mm256_sub_pd(_mm256_cvtps_pd(_mm_load_ps(pack.v1[a])), v0[a]);
+      e2[a] = _mm256_sub_pd(_mm256_cvtps_pd(_mm_load_ps(pack.v2[a])), v0[a]);
+      dir[a] = _mm256_set1_pd(r.direction()[a]);
+      tvec[a] = _mm256_sub_pd(_mm256_set1_pd(r.origin()[a]), v0[a]);
+    }
+
+    auto cross = [](const __m256d *x, const __m256d *y, __m256d *out)
+    {
+      out[0] = _mm256_sub_pd(_mm256_mul_pd(x[1], y[2]), _mm256_mul_pd(x[2], y[1]));
+      out[1] = _mm256_sub_pd(_mm256_mul_pd(x[2], y[0]), _mm256_mul_pd(x[0], y[2]));
+      out[2] = _mm256_sub_pd(_mm256_mul_pd(x[0], y[1]), _mm256_mul_pd(x[1], y[0]));
+    };
+    auto dot = [](const __m256d *x, const __m256d *y)
+    { return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x[0], y[0]), _mm256_mul_pd(x[1], y[1])), _mm256_mul_pd(x[2], y[2])); };
+
+    __m256d pvec[3], qvec[3];
+    cross(dir, e2, pvec);
+    const __m256d det = dot(e1, pvec);
+    const __m256d inv_det = _mm256_div_pd(_mm256_set1_pd(1), det);
+    const __m256d u = _mm256_mul_pd(dot(tvec, pvec), inv_det);
+    cross(tvec, e1, qvec);
+    const __m256d v = _mm256_mul_pd(dot(dir, qvec), inv_det);
+    const __m256d t = _mm256_mul_pd(dot(e2, qvec), inv_det);
+
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1);
+    __m256d hit = _mm256_cmp_pd(det, zero, _CMP_NEQ_OQ);
+    hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(u, zero, _CMP_GE_OQ), _mm256_cmp_pd(u, one, _CMP_LE_OQ)));
+    hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(v, zero, _CMP_GE_OQ), _mm256_cmp_pd(_mm256_add_pd(u, v), one, _CMP_LE_OQ)));
+    hit = _mm256_and_pd(hit, _mm256_and_pd(_mm256_cmp_pd(t, _mm256_set1_pd(t_min), _CMP_GE_OQ),
+                                           _mm256_cmp_pd(t, _mm256_set1_pd(t_max), _CMP_LE_OQ)));
+
+    _mm256_storeu_pd(t_out, t);
+    _mm256_storeu_pd(u_out, u);
+    _mm256_storeu_pd(v_out, v);
+    return _mm256_movemask_pd(hit);
+  }
+#endif
+}
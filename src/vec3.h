@@ -3,21 +3,30 @@
 #include <cmath>
 #include <iostream>
 
-class Vec3
+/// 3D vector with Scalar (double or float) components. Vec3 (double) is used everywhere; intersection
+/// kernels are templated on the scalar type too, so that primitives can intersect in single precision
+template <typename Scalar>
+class Vec3T
 {
 public:
-  Vec3() : e{0, 0, 0} {}
-  Vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+  using scalar_type = Scalar;
 
-  double x() const { return e[0]; }
-  double y() const { return e[1]; }
-  double z() const { return e[2]; }
+  Vec3T() : e{0, 0, 0} {}
+  Vec3T(Scalar e0, Scalar e1, Scalar e2) : e{e0, e1, e2} {}
 
-  Vec3 operator-() const { return Vec3(-e[0], -e[1], -e[2]); }
-  double operator[](int i) const { return e[i]; }
-  double &operator[](int i) { return e[i]; }
+  /// Conversion between precisions
+  template <typename Other>
+  explicit Vec3T(const Vec3T<Other> &v) : e{Scalar(v[0]), Scalar(v[1]), Scalar(v[2])} {}
 
-  Vec3 &operator+=(const Vec3 &v)
+  Scalar x() const { return e[0]; }
+  Scalar y() const { return e[1]; }
+  Scalar z() const { return e[2]; }
+
+  Vec3T operator-() const { return Vec3T(-e[0], -e[1], -e[2]); }
+  Scalar operator[](int i) const { return e[i]; }
+  Scalar &operator[](int i) { return e[i]; }
+
+  Vec3T &operator+=(const Vec3T &v)
   {
     e[0] += v.e[0];
     e[1] += v.e[1];
@@ -25,7 +34,7 @@ public:
     return *this;
   }
 
-  Vec3 &operator*=(const double t)
+  Vec3T &operator*=(const Scalar t)
   {
     e[0] *= t;
     e[1] *= t;
@@ -33,17 +42,17 @@ public:
     return *this;
   }
 
-  Vec3 &operator/=(const double t)
+  Vec3T &operator/=(const Scalar t)
   {
     return *this *= 1 / t;
   }
 
-  double length() const
+  Scalar length() const
   {
     return std::sqrt(length_squared());
   }
 
-  double length_squared() const
+  Scalar length_squared() const
   {
     return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
   }
@@ -51,86 +60,98 @@ public:
   bool near_zero() const
   {
     // Return true if the vector is close to zero in all dimensions.
-    const auto s = 1e-8;
-    return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+    const Scalar s = 1e-8;
+    return (std::abs(e[0]) < s) && (std::abs(e[1]) < s) && (std::abs(e[2]) < s);
   }
 
-  inline static Vec3 random()
+  inline static Vec3T random()
   {
-    return Vec3(random_double(), random_double(), random_double());
+    return Vec3T(random_double(), random_double(), random_double());
   }
 
-  inline static Vec3 random(double min, double max)
+  inline static Vec3T random(double min, double max)
   {
-    return Vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+    return Vec3T(random_double(min, max), random_double(min, max), random_double(min, max));
   }
 
-  inline static Vec3 Zero()
+  inline static Vec3T Zero()
   {
-    return Vec3(0, 0, 0);
+    return Vec3T(0, 0, 0);
   }
 
 public:
-  double e[3];
+  Scalar e[3];
 };
 
 // Type aliases for Vec3
+using Vec3 = Vec3T<double>;
 using Point3 = Vec3; // 3D point
 using Color = Vec3;  // RGB color
 
-// Vec3 Utility Functions
-inline std::ostream &operator<<(std::ostream &out, const Vec3 &v)
+// Vec3 Utility Functions. Scalar arguments use scalar_type so that they don't take part in template
+// argument deduction, and e.g. 2 * v works for any precision
+template <typename Scalar>
+inline std::ostream &operator<<(std::ostream &out, const Vec3T<Scalar> &v)
 {
   return out << v.e[0] << ", " << v.e[1] << ", " << v.e[2];
 }
 
-inline Vec3 operator+(const Vec3 &u, const Vec3 &v)
+template <typename Scalar>
+inline Vec3T<Scalar> operator+(const Vec3T<Scalar> &u, const Vec3T<Scalar> &v)
 {
-  return Vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+  return Vec3T<Scalar>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline Vec3 operator-(const Vec3 &u, const Vec3 &v)
+template <typename Scalar>
+inline Vec3T<Scalar> operator-(const Vec3T<Scalar> &u, const Vec3T<Scalar> &v)
 {
-  return Vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+  return Vec3T<Scalar>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3 &u, const Vec3 &v)
+template <typename Scalar>
+inline Vec3T<Scalar> operator*(const Vec3T<Scalar> &u, const Vec3T<Scalar> &v)
 {
-  return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+  return Vec3T<Scalar>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline Vec3 operator*(double t, const Vec3 &v)
+template <typename Scalar>
+inline Vec3T<Scalar> operator*(typename Vec3T<Scalar>::scalar_type t, const Vec3T<Scalar> &v)
 {
-  return Vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+  return Vec3T<Scalar>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3 &v, double t)
+template <typename Scalar>
+inline Vec3T<Scalar> operator*(const Vec3T<Scalar> &v, typename Vec3T<Scalar>::scalar_type t)
 {
   return t * v;
 }
 
-inline Vec3 operator/(Vec3 v, double t)
+template <typename Scalar>
+inline Vec3T<Scalar> operator/(Vec3T<Scalar> v, typename Vec3T<Scalar>::scalar_type t)
 {
   return (1 / t) * v;
 }
 
-inline double dot(const Vec3 &u, const Vec3 &v)
+template <typename Scalar>
+inline Scalar dot(const Vec3T<Scalar> &u, const Vec3T<Scalar> &v)
 {
   return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
 }
 
-inline Vec3 cross(const Vec3 &u, const Vec3 &v)
+template <typename Scalar>
+inline Vec3T<Scalar> cross(const Vec3T<Scalar> &u, const Vec3T<Scalar> &v)
 {
-  return Vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-              u.e[2] * v.e[0] - u.e[0] * v.e[2],
-              u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+  return Vec3T<Scalar>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+                       u.e[2] * v.e[0] - u.e[0] * v.e[2],
+                       u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline Vec3 unit_vector(Vec3 v)
+template <typename Scalar>
+inline Vec3T<Scalar> unit_vector(Vec3T<Scalar> v)
 {
-  const double norm = v.length();
-  if (norm < 1e-12)
-    return Vec3::Zero();
+  const Scalar norm = v.length();
+  if (norm < Scalar(1e-12))
+    return Vec3T<Scalar>::Zero();
   else
     return v / norm;
 }
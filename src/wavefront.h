@@ -0,0 +1,219 @@
+#pragma once
+
+#include "camera.h"
+#include "common.h"
+#include "hittable.h"
+#include "material.h"
+#include "parallel.h"
+#include "render.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+/// State of one path in flight in the wavefront renderer
+struct WavefrontPath
+{
+  Ray ray;
+  Color throughput;
+  Color radiance;
+  double emission_weight; // see shade_hit()
+  hit_record rec;
+  Pcg32 rng_state; // generator state is carried from the intersection to the shading stage of a bounce
+  int pixel;       // row * W + col, same indexing as render() uses for seeding
+  int sample;
+};
+
+/// Entry in the material queue. Sorting by (material type, material) groups hits that run the same
+/// scatter() code on the same data together
+struct MaterialWorkItem
+{
+  MaterialType type;
+  const Material *material;
+  int path;
+
+  bool operator<(const MaterialWorkItem &other) const
+  {
+    if (type != other.type)
+      return type < other.type;
+    if (material != other.material)
+      return std::less<const Material *>()(material, other.material);
+    return path < other.path;
+  }
+};
+
+/// Entry in the shadow queue: a shadow ray sampled while shading paths[path]
+struct ShadowWorkItem
+{
+  ShadowRay shadow;
+  int path;
+};
+
+/// Breadth-first alternative to render(): traces a large batch of paths one bounce at a time. Each bounce
+/// runs as stages over all live paths in the batch:
+///   1. extension: closest-hit query for every ray in the extension queue
+///   2. shading: hits are sorted by material type, then emitted()/scatter() run over the sorted queue;
+///      surviving paths go into the extension queue for the next bounce. With next-event estimation,
+///      shading samples each hit's shadow ray and puts it into the shadow queue
+///   3. shadow rays (next-event estimation only): the shadow queue is traced, and the light found is
+///      added to the paths. Tracing draws no random numbers, so they're still used in the same order
+///      as in render()
+/// This way each stage runs the same code over many paths back-to-back, instead of alternating between
+/// traversal and different materials' scatter() for every single ray.
+///
+/// Random numbers are seeded per (pixel, sample, bounce) like in render(), and samples are accumulated
+/// in the same order, so both renderers produce identical images.
+void render_wavefront(std::ostream &out, const Hittable &world, shared_ptr<Hittable> lights, const Camera &cam, int H, int W, const Color &background, int samples_per_pixel, int max_depth, const RenderOptions &opts = RenderOptions())
+{
+  ThreadPool pool(std::max(1, opts.num_threads)); // reused by every stage of every bounce and batch
+  const long long total_paths = static_cast<long long>(H) * W * samples_per_pixel;
+  const int batch_size = static_cast<int>(std::min<long long>(std::max(1, opts.wavefront_batch_size), total_paths));
+
+  std::vector<Color> pixel_sums(H * W, Color(0, 0, 0));
+  std::atomic<int> num_pixels_done(0);
+
+  std::unique_ptr<ProgressReporter> reporter;
+  if (opts.print_progress)
+    reporter = std::make_unique<ProgressReporter>(num_pixels_done, H * W, opts.progress_interval_ms);
+
+  std::vector<WavefrontPath> paths(batch_size);
+  std::vector<int> extension_queue(batch_size);
+  std::vector<int> next_extension_queue(batch_size);
+  std::vector<MaterialWorkItem> material_queue(batch_size);
+  std::vector<ShadowWorkItem> shadow_queue(opts.integrator == Integrator::NextEventEstimation ? batch_size : 0);
+
+  for (long long batch_start = 0; batch_start < total_paths; batch_start += batch_size)
+  {
+    const int num_paths = static_cast<int>(std::min<long long>(batch_size, total_paths - batch_start));
+
+    // Camera rays. Paths are numbered pixel-major, so that all samples of a pixel are adjacent
+    pool.parallel_for(num_paths, [&](int begin, int end)
+                      {
+                        for (int i = begin; i < end; ++i)
+                        {
+                          auto &path = paths[i];
+                          const long long path_id = batch_start + i;
+                          path.pixel = static_cast<int>(path_id / samples_per_pixel);
+                          path.sample = static_cast<int>(path_id % samples_per_pixel);
+
+                          const int row = path.pixel / W;
+                          const int col = path.pixel % W;
+                          rng::start_path(path.pixel, path.sample);
+                          auto u = (col + random_double()) / (W - 1);
+                          auto v = (row + random_double()) / (H - 1);
+                          path.ray = cam.get_ray(u, v);
+
+                          path.throughput = Color(1, 1, 1);
+                          path.radiance = Color(0, 0, 0);
+                          path.emission_weight = 1;
+                          extension_queue[i] = i;
+                        }
+                      });
+    int num_extension = num_paths;
+
+    for (int bounce = 1; bounce <= max_depth && num_extension > 0; ++bounce)
+    {
+      // Extension rays: find closest hits. Misses pick up the background and leave the batch
+      std::atomic<int> num_material(0);
+      pool.parallel_for(num_extension, [&](int begin, int end)
+                        {
+                          for (int k = begin; k < end; ++k)
+                          {
+                            const int idx = extension_queue[k];
+                            auto &path = paths[idx];
+                            rng::start_path(path.pixel, path.sample, bounce);
+
+                            if (world.hit(path.ray, 0.001, infinity, &path.rec))
+                            {
+                              const Material *mat = path.rec.mat_ptr;
+                              material_queue[num_material.fetch_add(1, std::memory_order_relaxed)] = {mat->type, mat, idx};
+                            }
+                            else
+                            {
+                              path.radiance += path.throughput * background;
+                            }
+                            path.rng_state = rng::thread_generator();
+                          }
+                        });
+
+      // Material evaluation, grouped by material type. Dispatches on the type once per run of hits on
+      // the same type, and shades the run with direct calls to that material class
+      const int material_count = num_material.load();
+      std::sort(material_queue.begin(), material_queue.begin() + material_count);
+
+      std::atomic<int> num_next(0);
+      std::atomic<int> num_shadow(0);
+      pool.parallel_for(material_count, [&](int begin, int end)
+                        {
+                          for (int run_begin = begin; run_begin < end;)
+                          {
+                            int run_end = run_begin + 1;
+                            while (run_end < end && material_queue[run_end].type == material_queue[run_begin].type)
+                              ++run_end;
+
+                            material::visit(*material_queue[run_begin].material, [&](const auto &first)
+                                            {
+                                              using M = std::decay_t<decltype(first)>;
+                                              for (int k = run_begin; k < run_end; ++k)
+                                              {
+                                                const int idx = material_queue[k].path;
+                                                auto &path = paths[idx];
+                                                rng::thread_generator() = path.rng_state;
+
+                                                const M &material = static_cast<const M &>(*material_queue[k].material);
+                                                std::optional<ShadowRay> shadow_ray;
+                                                if (shade_hit(material, path.ray, path.rec, lights.get(), opts.integrator, bounce, &path.radiance,
+                                                              &path.throughput, &path.emission_weight, &path.ray, &shadow_ray))
+                                                  next_extension_queue[num_next.fetch_add(1, std::memory_order_relaxed)] = idx;
+                                                if (shadow_ray)
+                                                  shadow_queue[num_shadow.fetch_add(1, std::memory_order_relaxed)] = {*shadow_ray, idx};
+                                              } });
+                            run_begin = run_end;
+                          }
+                        });
+
+      // Shadow rays. Each path has at most one in the queue, and its shading is done, so the light gets
+      // added to radiance in the same order as in render()
+      pool.parallel_for(num_shadow.load(), [&](int begin, int end)
+                        {
+                          for (int k = begin; k < end; ++k)
+                            paths[shadow_queue[k].path].radiance += trace_shadow_ray(shadow_queue[k].shadow, world);
+                        });
+
+      // Queue order doesn't matter for results (every path has its own random numbers), but keep it
+      // sorted so that memory access into paths stays mostly sequential
+      num_extension = num_next.load();
+      std::sort(next_extension_queue.begin(), next_extension_queue.begin() + num_extension);
+      std::swap(extension_queue, next_extension_queue);
+    }
+
+    // Accumulate in path order, which is the same order render() adds up samples in
+    for (int i = 0; i < num_paths; ++i)
+      pixel_sums[paths[i].pixel] += paths[i].radiance;
+
+    num_pixels_done.store(static_cast<int>((batch_start + num_paths) / samples_per_pixel), std::memory_order_relaxed);
+  }
+
+  reporter.reset();
+
+  // pixel values are listed in row-major order in ppm format, from top down
+  std::vector<Color> pixel_values(H * W);
+  for (int row = 0; row < H; ++row)
+  {
+    for (int col = 0; col < W; ++col)
+    {
+      Color pixel_color = pixel_sums[row * W + col];
+      pixel_color /= samples_per_pixel;
+      pixel_values[col + (H - 1 - row) * W] = pixel_color;
+    }
+  }
+
+  write_ppm(out, H, W, pixel_values);
+
+  if (opts.print_progress)
+    std::cerr << "\nDone.\n";
+}
@@ -0,0 +1,463 @@
+#pragma once
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/// Node of a BVH with Width children per node. Children's bounds are stored as SoA float arrays, so that
+/// one sequence of SIMD instructions tests the ray against all of them at once
+template <int Width>
+struct alignas(32) WideBVHNode
+{
+  // bounds[0..2]: min x/y/z, bounds[3..5]: max x/y/z, one lane per child.
+  // Unused child slots have inverted (empty) bounds, so they never pass the slab test
+  float bounds[6][Width];
+  int32_t child[Width];  // interior child: node index. leaf child: index of first primitive
+  uint32_t count[Width]; // number of primitives for leaf children; 0 for interior children
+};
+
+/// Children's bounds at the end of the time interval, for BVHs over moving primitives
+template <int Width>
+struct alignas(32) WideBVHBounds
+{
+  float bounds[6][Width];
+};
+
+namespace bvh
+{
+  /// Slab test of ray against the bounds of all children of a node. Returns bitmask of children that were
+  /// hit, and writes each child's entry distance to t_entry
+  template <int Width>
+  inline int intersect_children(const float (&bounds)[6][Width], const RayTraversalData &ray, float t_min, float t_max, float *t_entry)
+  {
+    // Portable version. Slab planes are picked by ray direction sign, so no min/max per axis is needed
+    int mask = 0;
+    for (int i = 0; i < Width; ++i)
+    {
+      float t_near = t_min;
+      float t_far = t_max;
+      for (int a = 0; a < 3; ++a)
+      {
+        const float tn = (bounds[a + 3 * ray.dir_is_neg[a]][i] - ray.origin[a]) * ray.inv_dir[a];
+        const float tf = (bounds[a + 3 * (1 - ray.dir_is_neg[a])][i] - ray.origin[a]) * ray.inv_dir[a] * slab_exit_padding<float>;
+        t_near = tn > t_near ? tn : t_near; // NaN-safe, like in slab_test()
+        t_far = tf < t_far ? tf : t_far;
+      }
+      t_entry[i] = t_near;
+      mask |= (t_near <= t_far) << i;
+    }
+    return mask;
+  }
+
+#ifdef BUBBLES_HAVE_SSE
+  template <>
+  inline int intersect_children<4>(const float (&bounds)[6][4], const RayTraversalData &ray, float t_min, float t_max, float *t_entry)
+  {
+    __m128 t_near = _mm_set1_ps(t_min);
+    __m128 t_far = _mm_set1_ps(t_max);
+    const __m128 padding = _mm_set1_ps(slab_exit_padding<float>);
+
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m128 origin = _mm_set1_ps(ray.origin[a]);
+      const __m128 inv_dir = _mm_set1_ps(ray.inv_dir[a]);
+      const __m128 tn = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[a + 3 * ray.dir_is_neg[a]]), origin), inv_dir);
+      const __m128 tf = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(bounds[a + 3 * (1 - ray.dir_is_neg[a])]), origin), inv_dir);
+
+      // minps/maxps return the second operand if either is NaN, so accumulators go second
+      t_near = _mm_max_ps(tn, t_near);
+      t_far = _mm_min_ps(_mm_mul_ps(tf, padding), t_far);
+    }
+
+    _mm_store_ps(t_entry, t_near);
+    return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+  }
+#endif
+
+#ifdef __AVX__
+  template <>
+  inline int intersect_children<8>(const float (&bounds)[6][8], const RayTraversalData &ray, float t_min, float t_max, float *t_entry)
+  {
+    __m256 t_near = _mm256_set1_ps(t_min);
+    __m256 t_far = _mm256_set1_ps(t_max);
+    const __m256 padding = _mm256_set1_ps(slab_exit_padding<float>);
+
+    for (int a = 0; a < 3; ++a)
+    {
+      const __m256 origin = _mm256_set1_ps(ray.origin[a]);
+      const __m256 inv_dir = _mm256_set1_ps(ray.inv_dir[a]);
+      const __m256 tn = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds[a + 3 * ray.dir_is_neg[a]]), origin), inv_dir);
+      const __m256 tf = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds[a + 3 * (1 - ray.dir_is_neg[a])]), origin), inv_dir);
+
+      t_near = _mm256_max_ps(tn, t_near);
+      t_far = _mm256_min_ps(_mm256_mul_ps(tf, padding), t_far);
+    }
+
+    _mm256_store_ps(t_entry, t_near);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+  }
+#endif
+}
+
+/// BVH4 / BVH8: compiled from a binary BVHNode tree by collapsing it, so that each node has up to Width
+/// children. Traversal tests all children of a node with one SIMD slab test (SSE for BVH4, AVX for BVH8
+/// when compiled with AVX enabled; otherwise a portable loop), then visits hit children nearest-first.
+///
+/// Moving primitives are handled like in LinearBVH: children's bounds at both ends of the time interval
+/// are interpolated at the ray's time. Leaves intersect built-in primitive types from typed arrays too.
+template <int Width>
+class WideBVH : public Hittable
+{
+  static_assert(Width >= 2 && Width <= 32, "children of a node are tracked in an int bitmask");
+
+public:
+  WideBVH() = default;
+
+  /// Compile given tree, built over time interval [time0, time1]
+  explicit WideBVH(const BVHNode &root, double time0 = 0, double time1 = 1) : time0(time0), time1(time1)
+  {
+    root.bounding_box(time0, time1, &box);
+
+    // Root gets its own node even if tree is just one leaf, so that traversal always starts at a node
+    nodes.emplace_back();
+    std::vector<const BVHNode *> children = {&root};
+    if (!root.is_leaf())
+      children = collapse(root);
+    fill_node(0, children, 1);
+    typed_primitives.assign(primitives);
+
+    for (const auto &prim : primitives)
+    {
+      if (bvh::is_moving(*prim, time0, time1))
+      {
+        fit_motion_bounds();
+        break;
+      }
+    }
+  }
+
+  /// Build BVHNode tree over objects, then compile it
+  WideBVH(const HittableList &list, double time0, double time1, const BVHBuildOptions &opts = BVHBuildOptions())
+      : WideBVH(BVHNode(list, time0, time1, opts), time0, time1)
+  {
+  }
+
+  virtual bool hit(const Ray &r, double t_min, double t_max, hit_record *rec) const override
+  {
+    return deferred_hit(*this, r, t_min, t_max, rec);
+  }
+
+  virtual bool intersect(const Ray &r, double t_min, double t_max, surface_hit *result) const override
+  {
+    return traverse<false>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                           {
+                             if (!prim.intersect(r, t_min, *t_closest, result))
+                               return false;
+                             *t_closest = result->t;
+                             return true; });
+  }
+
+  virtual bool hit_distance(const Ray &r, double t_min, double t_max, double *t) const override
+  {
+    return traverse<false>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                           {
+                             if (!prim.hit_distance(r, t_min, *t_closest, t))
+                               return false;
+                             *t_closest = *t;
+                             return true; });
+  }
+
+  virtual bool occluded(const Ray &r, double t_min, double t_max) const override
+  {
+    return traverse<true>(r, t_min, t_max, [&](const auto &prim, double *t_closest)
+                          { return prim.occluded(r, t_min, *t_closest); });
+  }
+
+  virtual bool bounding_box(double /*time0*/, double /*time1*/, AABB *output_box) const override
+  {
+    *output_box = box;
+    return true;
+  }
+
+public:
+  std::vector<WideBVHNode<Width> > nodes;
+  std::vector<shared_ptr<Hittable> > primitives; // in leaf order, each leaf sorted by type
+  PrimitiveArrays typed_primitives;              // copies of primitives that leaves are intersected with
+  AABB box;
+
+  // Children's bounds at time1 when primitives move, with nodes holding bounds at time0. Empty otherwise
+  std::vector<WideBVHBounds<Width> > end_bounds;
+  double time0 = 0;
+  double time1 = 1;
+
+private:
+  static constexpr int max_depth = 64;
+  static constexpr int max_stack_size = max_depth * (Width - 1) + 1;
+
+  /// Children of binary node that become children of one wide node: keep opening up the interior child
+  /// with largest surface area until there are Width children
+  static std::vector<const BVHNode *> collapse(const BVHNode &node);
+
+  void fill_node(int node_idx, const std::vector<const BVHNode *> &children, int depth);
+
+  /// Set bounds(i) to the bounds of node i's children at time, bottom-up
+  template <typename BoundsFn>
+  void fit_bounds(double time, BoundsFn bounds);
+
+  /// Node bounds at time0 and end_bounds at time1
+  void fit_motion_bounds();
+
+  /// Same as LinearBVH::traverse()
+  template <bool AnyHit, typename IntersectFn>
+  bool traverse(const Ray &r, double t_min, double t_max, IntersectFn intersect) const;
+};
+
+template <int Width>
+std::vector<const BVHNode *> WideBVH<Width>::collapse(const BVHNode &node)
+{
+  std::vector<const BVHNode *> children;
+  for (const auto &c : {node.left, node.right})
+  {
+    auto child = dynamic_cast<const BVHNode *>(c.get());
+    assert(child); // builder only puts BVHNodes in interior nodes
+    children.push_back(child);
+  }
+
+  while (static_cast<int>(children.size()) < Width)
+  {
+    int best = -1;
+    double best_area = -1;
+    for (size_t i = 0; i < children.size(); ++i)
+    {
+      if (!children[i]->is_leaf() && children[i]->box.surface_area() > best_area)
+      {
+        best = i;
+        best_area = children[i]->box.surface_area();
+      }
+    }
+    if (best < 0)
+      break; // only leaves left
+
+    const BVHNode *opened = children[best];
+    children[best] = dynamic_cast<const BVHNode *>(opened->left.get());
+    children.push_back(dynamic_cast<const BVHNode *>(opened->right.get()));
+  }
+
+  return children;
+}
+
+template <int Width>
+void WideBVH<Width>::fill_node(int node_idx, const std::vector<const BVHNode *> &children, int depth)
+{
+  for (int i = 0; i < Width; ++i)
+  {
+    for (int a = 0; a < 3; ++a)
+    {
+      nodes[node_idx].bounds[a][i] = std::numeric_limits<float>::infinity();
+      nodes[node_idx].bounds[a + 3][i] = -std::numeric_limits<float>::infinity();
+    }
+    nodes[node_idx].child[i] = -1;
+    nodes[node_idx].count[i] = 0;
+  }
+
+  for (size_t i = 0; i < children.size(); ++i)
+  {
+    const BVHNode &child = *children[i];
+    for (int a = 0; a < 3; ++a)
+    {
+      nodes[node_idx].bounds[a][i] = bvh::round_down(child.box.min()[a]);
+      nodes[node_idx].bounds[a + 3][i] = bvh::round_up(child.box.max()[a]);
+    }
+
+    // A child whose subtree would be too deep for the traversal stack becomes one leaf with all of its
+    // primitives
+    const bool too_deep = depth + 1 >= max_depth;
+    if (child.is_leaf() || too_deep)
+    {
+      std::vector<shared_ptr<Hittable> > subtree_primitives;
+      if (too_deep && !child.is_leaf())
+        bvh::gather_primitives(child, &subtree_primitives);
+      const auto &leaf_primitives = child.is_leaf() ? child.primitives : subtree_primitives;
+
+      nodes[node_idx].child[i] = primitives.size();
+      nodes[node_idx].count[i] = leaf_primitives.size();
+      for (const auto &prim : leaf_primitives)
+      {
+        auto nested_bvh = std::dynamic_pointer_cast<BVHNode>(prim);
+        primitives.push_back(nested_bvh ? make_shared<WideBVH<Width> >(*nested_bvh, time0, time1) : prim);
+      }
+      PrimitiveArrays::sort_leaf(primitives, nodes[node_idx].child[i], primitives.size());
+    }
+    else
+    {
+      const int child_idx = nodes.size();
+      nodes.emplace_back(); // may reallocate; index nodes[] again afterwards
+      nodes[node_idx].child[i] = child_idx;
+      fill_node(child_idx, collapse(child), depth + 1);
+    }
+  }
+}
+
+template <int Width>
+template <typename BoundsFn>
+void WideBVH<Width>::fit_bounds(double time, BoundsFn bounds)
+{
+  // Children are always stored after their parent, so going backwards visits children first
+  for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i)
+  {
+    float(&node_bounds)[6][Width] = bounds(i);
+    for (int c = 0; c < Width; ++c)
+    {
+      const int32_t child = nodes[i].child[c];
+      if (child < 0)
+        continue; // empty slot keeps its empty bounds
+
+      float child_min[3], child_max[3];
+      if (nodes[i].count[c] > 0)
+      {
+        AABB leaf_box;
+        for (uint32_t k = 0; k < nodes[i].count[c]; ++k)
+        {
+          AABB prim_box;
+          primitives[child + k]->bounding_box(time, time, &prim_box);
+          leaf_box = k == 0 ? prim_box : surrounding_box(leaf_box, prim_box);
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+          child_min[a] = bvh::round_down(leaf_box.min()[a]);
+          child_max[a] = bvh::round_up(leaf_box.max()[a]);
+        }
+      }
+      else
+      {
+        // Empty slots of the child node have inf/-inf bounds, so they drop out of the min/max
+        const float(&grandchildren)[6][Width] = bounds(child);
+        for (int a = 0; a < 3; ++a)
+        {
+          child_min[a] = *std::min_element(grandchildren[a], grandchildren[a] + Width);
+          child_max[a] = *std::max_element(grandchildren[a + 3], grandchildren[a + 3] + Width);
+        }
+      }
+
+      for (int a = 0; a < 3; ++a)
+      {
+        node_bounds[a][c] = child_min[a];
+        node_bounds[a + 3][c] = child_max[a];
+      }
+    }
+  }
+}
+
+template <int Width>
+void WideBVH<Width>::fit_motion_bounds()
+{
+  // Copy so that empty slots get their empty bounds at time1 too
+  end_bounds.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i)
+    std::copy(&nodes[i].bounds[0][0], &nodes[i].bounds[0][0] + 6 * Width, &end_bounds[i].bounds[0][0]);
+  fit_bounds(time0, [&](int i) -> float(&)[6][Width] { return nodes[i].bounds; });
+  fit_bounds(time1, [&](int i) -> float(&)[6][Width] { return end_bounds[i].bounds; });
+}
+
+template <int Width>
+template <bool AnyHit, typename IntersectFn>
+bool WideBVH<Width>::traverse(const Ray &r, double t_min, double t_max, IntersectFn intersect) const
+{
+  if (nodes.empty())
+    return false;
+
+  const bvh::RayTraversalData ray(r);
+
+  const bool motion = !end_bounds.empty();
+  const float s = motion ? static_cast<float>((r.time() - time0) / (time1 - time0)) : 0;
+  alignas(32) float lerped_bounds[6][Width];
+
+  struct StackEntry
+  {
+    int32_t child;
+    uint32_t count; // > 0 for leaves
+    float t_entry;
+  };
+  StackEntry stack[max_stack_size];
+  int stack_size = 0;
+  stack[stack_size++] = {0, 0, static_cast<float>(t_min)};
+
+  alignas(32) float t_entry[Width];
+  bool hit_anything = false;
+
+  while (stack_size > 0)
+  {
+    const StackEntry entry = stack[--stack_size];
+    if (entry.t_entry > t_max) // something closer than this whole subtree was hit already
+      continue;
+
+    if (entry.count > 0)
+    {
+      if (typed_primitives.for_each<AnyHit>(entry.child, entry.count, [&](const auto &prim)
+                                            { return intersect(prim, &t_max); }))
+      {
+        if (AnyHit)
+          return true;
+        hit_anything = true;
+      }
+      continue;
+    }
+
+    const WideBVHNode<Width> &node = nodes[entry.child];
+    int mask;
+    if (!motion)
+    {
+      mask = bvh::intersect_children<Width>(node.bounds, ray, t_min, t_max, t_entry);
+    }
+    else
+    {
+      // Empty slots have the same infinite bounds at both ends, which must not turn into NaN
+      const auto &end = end_bounds[entry.child].bounds;
+      for (int k = 0; k < 6; ++k)
+        for (int c = 0; c < Width; ++c)
+        {
+          const float start = node.bounds[k][c];
+          lerped_bounds[k][c] = start == end[k][c] ? start : start + s * (end[k][c] - start);
+        }
+      mask = bvh::intersect_children<Width>(lerped_bounds, ray, t_min, t_max, t_entry);
+    }
+
+    // Push hit children sorted by entry distance, farthest first, so that nearest gets popped first
+    const int first_pushed = stack_size;
+    while (mask)
+    {
+      const int i = __builtin_ctz(mask);
+      mask &= mask - 1;
+
+      StackEntry child_entry = {node.child[i], node.count[i], t_entry[i]};
+      int j = stack_size++;
+      while (j > first_pushed && stack[j - 1].t_entry < child_entry.t_entry)
+      {
+        stack[j] = stack[j - 1];
+        --j;
+      }
+      stack[j] = child_entry;
+    }
+  }
+
+  return hit_anything;
+}
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+/// Widest BVH that this build has SIMD slab tests for: without AVX, BVH8 falls back to scalar loops
+#ifdef __AVX__
+using NativeWideBVH = BVH8;
+#else
+using NativeWideBVH = BVH4;
+#endif
@@ -1,13 +1,25 @@
 #include "hittable.h"
 #include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "particle_cloud.h"
+#include "wide_bvh.h"
 #include "sphere.h"
+#include "transform.h"
 #include "triangle.h"
+#include "triangle_mesh.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include "external/tinyobjloader.h"
 
+#include <cstdio>
+#include <fstream>
+
 // TODO put in dependency on gtest?
-#define EXPECT_NEAR(a, b, tol) assert(abs(a - b) < tol);
+#define EXPECT_NEAR(a, b, tol) assert(std::abs((a) - (b)) < tol);
 #define EXPECT_LT(a, b) assert(a < b);
 
 void test_translate_importance_sampling()
@@ -77,6 +89,11 @@ void test_triangle()
     assert(t1.hit(Ray(origin, v_rand), 0, 1, &hrec));
   }
 
+  // Density per solid angle is twice that of the unit square that the triangle is half of
+  const XYRect square(0, 1, 0, 1, 1, nullptr);
+  const auto v_rand = t1.random(origin);
+  EXPECT_NEAR(t1.pdf_value(origin, v_rand), 2 * square.pdf_value(origin, v_rand), 1e-9);
+
   // Bounding box
   AABB bb;
   assert(t1.bounding_box(0, 1, &bb));
@@ -84,6 +101,592 @@ void test_triangle()
   assert(bb.min().x() < bb.max().x());
   assert(bb.min().y() < bb.max().z());
   assert(bb.min().y() < bb.max().z());
+
+  // Tiny triangles, as in dense meshes, are hit too
+  const double size = 1e-4;
+  const auto tiny = Triangle({Point3(0, 0, 1), Point3(0, size, 1), Point3(size, 0, 1)}, nullptr);
+  assert(tiny.hit(Ray(Point3(0.2 * size, 0.2 * size, 0), Vec3(0, 0, 1)), 0, 2, &hrec));
+}
+
+void test_single_precision()
+{
+  // Small sphere far away: b^2 - ac cancels catastrophically in float
+  Sphere sphere(Point3(1000, 500, -2000), 0.01, nullptr);
+  Sphere float_sphere = sphere;
+  float_sphere.single_precision = true;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const Point3 target = sphere.center0 + 0.0099 * random_unit_vector();
+    const Ray r(Point3(0, 0, 0), target);
+    double t, t_float;
+    assert(sphere.hit_distance(r, 0.001, infinity, &t));
+    assert(float_sphere.hit_distance(r, 0.001, infinity, &t_float));
+    EXPECT_NEAR(t_float, t, 1e-5 * t);
+  }
+
+  // Ray tangent to the sphere at its origin: q in intersect_sphere() is 0, and the only root is t = 0
+  const Ray tangent(Point3(1, 0, 0), Vec3(0, 3, 0));
+  double t_tangent;
+  assert(intersect_sphere(Vec3(0, 0, 0), 1.0, tangent, 0.0, infinity, &t_tangent) && t_tangent == 0);
+  assert(!intersect_sphere(Vec3(0, 0, 0), 1.0, tangent, 0.001, infinity, &t_tangent));
+  SpherePack<4> pack = {};
+  float t_lanes[4];
+  assert(sphere_pack::intersect(pack, 1, 1.0f, RayT<float>(tangent), 0.0f, float(infinity), t_lanes) == 1 && t_lanes[0] == 0);
+  assert(sphere_pack::intersect(pack, 1, 1.0f, RayT<float>(tangent), 0.001f, float(infinity), t_lanes) == 0);
+
+  // Mesh in float agrees with double except for rays within rounding error of an edge
+  TriangleMesh mesh(load_mesh_data("examples/meshes/teapot.obj"), nullptr);
+  int num_mismatches = 0;
+  const int num_rays = 10000;
+  for (int i = 0; i < num_rays; ++i)
+  {
+    const Ray r(Vec3::random(-10, 10), random_unit_vector());
+    mesh.single_precision = false;
+    double t, t_float;
+    const bool hit = mesh.hit_distance(r, 0.001, infinity, &t);
+    mesh.single_precision = true;
+    const bool hit_float = mesh.hit_distance(r, 0.001, infinity, &t_float);
+    assert(mesh.occluded(r, 0.001, infinity) == hit_float);
+    if (hit != hit_float || (hit && std::abs(t - t_float) > 1e-4 * t))
+      ++num_mismatches;
+  }
+  assert(num_mismatches < num_rays / 1000);
+}
+
+HittableList random_spheres(int n)
+{
+  HittableList spheres;
+  for (int i = 0; i < n; ++i)
+    spheres.add(make_shared<Sphere>(Vec3::random(-10, 10), random_double(0.1, 1.0), nullptr));
+  return spheres;
+}
+
+/// Closest hit against accelerator should be exactly what brute force over all objects finds, or within
+/// tolerance if they round differently. Also checks that the distance-only and any-hit queries agree with it
+void expect_same_hits(const Hittable &accel, const Hittable &reference, int num_rays, double tolerance = 1e-9)
+{
+  for (int i = 0; i < num_rays; ++i)
+  {
+    const Ray r(Vec3::random(-15, 15), random_unit_vector(), random_double());
+
+    hit_record accel_rec, ref_rec;
+    const bool accel_hit = accel.hit(r, 0.001, infinity, &accel_rec);
+    const bool ref_hit = reference.hit(r, 0.001, infinity, &ref_rec);
+    assert(accel_hit == ref_hit);
+    if (ref_hit)
+      EXPECT_NEAR(accel_rec.t, ref_rec.t, tolerance);
+
+    double t;
+    assert(accel.hit_distance(r, 0.001, infinity, &t) == ref_hit);
+    if (ref_hit)
+      EXPECT_NEAR(t, ref_rec.t, tolerance);
+
+    assert(accel.occluded(r, 0.001, infinity) == ref_hit);
+    if (ref_hit)
+    {
+      assert(accel.occluded(r, 0.001, ref_rec.t + tolerance));
+      assert(!accel.occluded(r, 0.001, ref_rec.t - 1e-6 - tolerance));
+    }
+  }
+}
+
+void test_bvh()
+{
+  const auto spheres = random_spheres(500);
+
+  const BVHNode sah_bvh(spheres, 0, 1);
+  expect_same_hits(sah_bvh, spheres, 2000);
+
+  BVHBuildOptions median_opts;
+  median_opts.split_method = BVHSplitMethod::RandomMedian;
+  const BVHNode median_bvh(spheres, 0, 1, median_opts);
+  expect_same_hits(median_bvh, spheres, 2000);
+
+  EXPECT_LT(sah_bvh.sah_cost(), median_bvh.sah_cost());
+
+  const LinearBVH linear_bvh(sah_bvh);
+  expect_same_hits(linear_bvh, spheres, 2000);
+  expect_same_hits(BVH4(sah_bvh), spheres, 2000);
+  expect_same_hits(BVH8(sah_bvh), spheres, 2000);
+
+  // Nested BVHs get compiled too
+  HittableList nested;
+  nested.add(make_shared<BVHNode>(spheres, 0, 1));
+  nested.add(make_shared<Sphere>(Point3(0, 0, 0), 20, nullptr));
+  expect_same_hits(LinearBVH(nested, 0, 1), nested, 2000);
+  expect_same_hits(BVH4(nested, 0, 1), nested, 2000);
+
+  // Parallel build makes the same tree as a single-threaded one
+  const auto many_spheres = random_spheres(20000);
+  BVHBuildOptions serial_opts, parallel_opts;
+  serial_opts.num_threads = 1;
+  parallel_opts.num_threads = 4;
+  const BVHNode serial_bvh(many_spheres, 0, 1, serial_opts);
+  const BVHNode parallel_bvh(many_spheres, 0, 1, parallel_opts);
+  assert(serial_bvh.sah_cost() == parallel_bvh.sah_cost());
+  expect_same_hits(parallel_bvh, serial_bvh, 2000);
+
+  // Whole tree is a single leaf
+  const auto few_spheres = random_spheres(3);
+  expect_same_hits(BVH8(few_spheres, 0, 1), few_spheres, 500);
+}
+
+void test_bvh_refit()
+{
+  std::vector<shared_ptr<Sphere> > spheres;
+  HittableList list;
+  for (int i = 0; i < 500; ++i)
+  {
+    spheres.push_back(make_shared<Sphere>(Vec3::random(-10, 10), random_double(0.1, 1.0), nullptr));
+    list.add(spheres.back());
+  }
+  LinearBVH bvh(list, 0, 1);
+
+  // Small moves: refit keeps hits correct, and the tree is still good enough to keep
+  for (auto &s : spheres)
+    s->center0 = s->center1 = s->center0 + Vec3::random(-0.2, 0.2);
+  assert(!bvh.refit_or_rebuild());
+  expect_same_hits(bvh, list, 2000);
+
+  // Shuffling everything makes refit bounds much worse than a fresh build
+  for (auto &s : spheres)
+    s->center0 = s->center1 = Vec3::random(-10, 10);
+  bvh.refit();
+  expect_same_hits(bvh, list, 2000);
+  assert(bvh.refit_or_rebuild());
+  EXPECT_NEAR(bvh.sah_cost(), LinearBVH(list, 0, 1).sah_cost(), 1e-9);
+  expect_same_hits(bvh, list, 2000);
+}
+
+void test_deep_bvh()
+{
+  // Binary tree deeper than compiled BVHs' traversal stacks, as a chain: each node has one sphere as its
+  // left leaf and the rest of the chain on the right. Too deep subtrees get compiled into single leaves
+  HittableList spheres;
+  const int chain_length = 300;
+  for (int i = 0; i < chain_length; ++i)
+    spheres.add(make_shared<Sphere>(Point3(i - 150, 0, 0), 0.4, nullptr));
+  shared_ptr<BVHNode> chain;
+  for (int i = chain_length - 1; i >= 0; --i)
+  {
+    auto leaf = make_shared<BVHNode>();
+    leaf->primitives = {spheres.objects[i]};
+    spheres.objects[i]->bounding_box(0, 1, &leaf->box);
+    if (!chain)
+    {
+      chain = leaf;
+      continue;
+    }
+    auto node = make_shared<BVHNode>();
+    node->left = leaf;
+    node->right = chain;
+    node->box = surrounding_box(leaf->box, chain->box);
+    chain = node;
+  }
+  const LinearBVH linear(*chain);
+  assert(linear.nodes.size() < 2 * static_cast<size_t>(bvh::max_stack_depth));
+  expect_same_hits(linear, spheres, 2000);
+  expect_same_hits(BVH4(*chain), spheres, 2000);
+
+  // Direct builds switch to median splits deep down, which keep leaves small and still fit the stack
+  std::vector<bvh::BuildPrimitive> prims(10000);
+  for (size_t i = 0; i < prims.size(); ++i)
+  {
+    const Point3 p = Vec3::random(-10, 10);
+    prims[i].box = AABB(p, p + Vec3(0.1, 0.1, 0.1));
+    prims[i].centroid = prims[i].box.centroid();
+    prims[i].index = i;
+  }
+  BVHBuildOptions opts;
+  std::vector<LinearBVHNode> nodes;
+  bvh::build_nodes(prims.data(), 0, prims.size(), opts, 1, &nodes, 1, bvh::max_sah_depth);
+  std::vector<int> depth(nodes.size(), bvh::max_sah_depth);
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    assert(depth[i] < bvh::max_stack_depth - 1);
+    if (nodes[i].num_primitives > 0)
+    {
+      assert(nodes[i].num_primitives <= static_cast<uint32_t>(opts.max_leaf_size));
+      continue;
+    }
+    depth[i + 1] = depth[nodes[i].offset] = depth[i] + 1;
+  }
+}
+
+void test_particle_cloud()
+{
+  // Same hits as the particles as single precision Spheres, up to the scalar version contracting
+  // multiply-adds that the SIMD kernel doesn't. Particle count isn't a multiple of the pack width
+  std::vector<Point3> positions;
+  for (int i = 0; i < 1001; ++i)
+    positions.push_back(Vec3::random(-10, 10));
+  const double radius = 0.3;
+
+  auto as_spheres = [&]()
+  {
+    HittableList spheres;
+    for (const auto &p : positions)
+    {
+      auto sphere = make_shared<Sphere>(p, radius, nullptr);
+      sphere->single_precision = true;
+      spheres.add(sphere);
+    }
+    return spheres;
+  };
+
+  ParticleCloud cloud(positions, radius, nullptr);
+  expect_same_hits(cloud, as_spheres(), 2000, 1e-5);
+
+  // Small moves refit, shuffling everything rebuilds
+  for (auto &p : positions)
+    p += Vec3::random(-0.2, 0.2);
+  assert(!cloud.move_particles(positions));
+  expect_same_hits(cloud, as_spheres(), 2000, 1e-5);
+
+  for (auto &p : positions)
+    p = Vec3::random(-10, 10);
+  assert(cloud.move_particles(positions));
+  EXPECT_NEAR(cloud.sah_cost(), ParticleCloud(positions, radius, nullptr).sah_cost(), 1e-9);
+  expect_same_hits(cloud, as_spheres(), 2000, 1e-5);
+
+  AABB box;
+  assert(!ParticleCloud({}, radius, nullptr).bounding_box(0, 1, &box));
+}
+
+void test_bvh_motion()
+{
+  // Spheres moving far compared to their size: bounds swept over the whole interval would overlap a lot
+  HittableList moving;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const Point3 center0 = Vec3::random(-10, 10);
+    moving.add(make_shared<Sphere>(center0, center0 + Vec3::random(-5, 5), 0, 1, random_double(0.1, 0.5), nullptr));
+  }
+
+  const LinearBVH linear(moving, 0, 1);
+  assert(!linear.end_bounds.empty());
+  expect_same_hits(linear, moving, 2000);
+
+  const BVH8 wide(moving, 0, 1);
+  assert(!wide.end_bounds.empty());
+  expect_same_hits(wide, moving, 2000);
+
+  // Nested BVHs (e.g. meshes) are compiled for the outer tree's interval too
+  HittableList nested;
+  nested.add(make_shared<BVHNode>(moving, 0, 0.5));
+  const LinearBVH outer_linear(nested, 0, 0.5);
+  const BVH8 outer_wide(nested, 0, 0.5);
+  assert(std::dynamic_pointer_cast<LinearBVH>(outer_linear.primitives[0])->time1 == 0.5);
+  assert(std::dynamic_pointer_cast<BVH8>(outer_wide.primitives[0])->time1 == 0.5);
+
+  // Instances of moving geometry move too, so the top-level BVH interpolates their bounds as well
+  auto moving_bvh = make_shared<LinearBVH>(moving, 0, 1);
+  HittableList instances;
+  instances.add(make_shared<Transform>(moving_bvh, Affine3::rotation(Vec3(0, 1, 0), 30)));
+  instances.add(make_shared<Transform>(moving_bvh, Affine3::translation(Vec3(3, -2, 1)) * Affine3::scaling(0.5)));
+  AABB start_box, swept_box;
+  instances.objects[0]->bounding_box(0, 0, &start_box);
+  instances.objects[0]->bounding_box(0, 1, &swept_box);
+  assert((swept_box.max() - swept_box.min()).length() > (start_box.max() - start_box.min()).length());
+  const LinearBVH linear_instances(instances, 0, 1);
+  assert(!linear_instances.end_bounds.empty());
+  expect_same_hits(linear_instances, instances, 2000);
+  const BVH8 wide_instances(instances, 0, 1);
+  assert(!wide_instances.end_bounds.empty());
+  expect_same_hits(wide_instances, instances, 2000);
+
+  // Static scenes don't pay for interpolation
+  assert(LinearBVH(random_spheres(100), 0, 1).end_bounds.empty());
+  assert(BVH8(random_spheres(100), 0, 1).end_bounds.empty());
+}
+
+void test_box()
+{
+  // Same hits as the box's six faces as separate rectangles
+  const Point3 p0(-3, -1, 2), p1(4, 5, 6);
+  const Box box(p0, p1, nullptr);
+  HittableList faces;
+  faces.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), nullptr));
+  faces.add(make_shared<XYRect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), nullptr));
+  faces.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), nullptr));
+  faces.add(make_shared<XZRect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), nullptr));
+  faces.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), nullptr));
+  faces.add(make_shared<YZRect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), nullptr));
+  expect_same_hits(box, faces, 5000);
+
+  // Outward normals and front faces, from outside and inside
+  hit_record rec;
+  assert(box.hit(Ray(Point3(0, 2, 0), Vec3(0, 0, 1)), 0.001, infinity, &rec));
+  assert(rec.front_face);
+  EXPECT_NEAR((rec.normal - Vec3(0, 0, -1)).length(), 0, 1e-12);
+  EXPECT_NEAR(rec.u, 3.0 / 7, 1e-12);
+  EXPECT_NEAR(rec.v, 3.0 / 6, 1e-12);
+  assert(box.hit(Ray(Point3(0, 2, 4), Vec3(1, 0, 0)), 0.001, infinity, &rec));
+  assert(!rec.front_face);
+  EXPECT_NEAR(rec.t, 4, 1e-12);
+
+  // Face sampling pdf integrates to 1 over all directions, and covers the directions it samples
+  for (const Point3 origin : {Point3(10, 8, -4), Point3(0, 0, 4)})
+  {
+    const int num_samples = 200000;
+    double integral = 0;
+    for (int i = 0; i < num_samples; ++i)
+      integral += box.pdf_value(origin, random_unit_vector());
+    EXPECT_NEAR(integral * 4 * pi / num_samples, 1, 0.05);
+
+    for (int i = 0; i < 100; ++i)
+      assert(box.pdf_value(origin, box.random(origin)) > 0);
+  }
+}
+
+void test_deferred_hit()
+{
+  // Aggregates compute attributes only for the closest hit; those should be exactly what the closest
+  // object's own hit() computes, for each kind of primitive
+  std::vector<shared_ptr<Hittable> > objects;
+  auto material = [] { return make_shared<Lambertian>(Color(0.5, 0.5, 0.5)); };
+  for (int i = 0; i < 10; ++i)
+  {
+    const Point3 p = Vec3::random(-8, 8);
+    objects.push_back(make_shared<Sphere>(p, 1.5, material()));
+    objects.push_back(make_shared<Triangle>(
+        std::array<Point3, 3>{p + Vec3(2, 0, 0), p + Vec3(0, 3, 1), p + Vec3(-1, 0, 2)}, material()));
+    objects.push_back(make_shared<Box>(p - Vec3(1, 1, 1), p + Vec3(1, 2, 0.5), material()));
+    objects.push_back(make_shared<XZRect>(p.x() - 2, p.x() + 2, p.z() - 2, p.z() + 2, p.y() - 3, material()));
+    objects.push_back(make_shared<Translate>(make_shared<Sphere>(Point3(0, 0, 0), 1, material()), p));
+  }
+  HittableList list;
+  for (const auto &object : objects)
+    list.add(object);
+
+  auto expect_eager_attributes = [&](const Hittable &accel)
+  {
+    for (int i = 0; i < 2000; ++i)
+    {
+      const Ray r(Vec3::random(-15, 15), random_unit_vector(), random_double());
+      hit_record ref_rec;
+      bool ref_hit = false;
+      double t_max = infinity;
+      for (const auto &object : objects)
+      {
+        if (object->hit(r, 0.001, t_max, &ref_rec))
+        {
+          ref_hit = true;
+          t_max = ref_rec.t;
+        }
+      }
+
+      hit_record rec;
+      assert(accel.hit(r, 0.001, infinity, &rec) == ref_hit);
+      if (!ref_hit)
+        continue;
+      assert(rec.t == ref_rec.t);
+      assert((rec.p - ref_rec.p).length_squared() == 0);
+      assert((rec.normal - ref_rec.normal).length_squared() == 0);
+      assert(rec.u == ref_rec.u && rec.v == ref_rec.v);
+      assert(rec.front_face == ref_rec.front_face);
+      assert(rec.mat_ptr == ref_rec.mat_ptr);
+    }
+  };
+  expect_eager_attributes(list);
+  expect_eager_attributes(BVHNode(list, 0, 1));
+  expect_eager_attributes(LinearBVH(list, 0, 1));
+  expect_eager_attributes(BVH4(list, 0, 1));
+}
+
+void test_typed_leaves()
+{
+  // Leaves hold a mix of types in big leaves; each leaf's primitives end up grouped by type, copied
+  // into the typed arrays, and hits are the same as without the BVH
+  HittableList list;
+  for (int i = 0; i < 40; ++i)
+  {
+    const Point3 p = Vec3::random(-3, 3);
+    list.add(make_shared<Sphere>(p, 0.5, nullptr));
+    list.add(make_shared<XYRect>(p.x(), p.x() + 1, p.y(), p.y() + 1, p.z(), nullptr));
+    list.add(make_shared<Box>(p, p + Vec3(0.5, 0.5, 0.5), nullptr));
+    list.add(make_shared<Translate>(make_shared<Sphere>(Point3(0, 0, 0), 0.3, nullptr), p));
+  }
+  BVHBuildOptions big_leaves;
+  big_leaves.max_leaf_size = 16;
+  const LinearBVH bvh(list, 0, 1, big_leaves);
+
+  const auto &typed = bvh.typed_primitives;
+  assert(typed.spheres.size() == 40 && typed.xy_rects.size() == 40 && typed.boxes.size() == 40);
+  assert(typed.others.size() == 40 && typed.triangles.empty());
+  for (const auto &node : bvh.nodes)
+  {
+    for (uint32_t k = 1; k < node.num_primitives; ++k)
+      assert(PrimitiveArrays::kind(*bvh.primitives[node.offset + k - 1]) <=
+             PrimitiveArrays::kind(*bvh.primitives[node.offset + k]));
+  }
+
+  // Box faces lie on their leaf's bounds, which compiled BVHs test in float, so any-hit queries ending
+  // exactly at a box hit need a little slack
+  expect_same_hits(bvh, list, 2000, 1e-5);
+  expect_same_hits(BVH8(list, 0, 1, big_leaves), list, 2000, 1e-5);
+
+  // Typed arrays hold copies, which refit() updates after a primitive changed (within the bounds)
+  auto sphere = std::dynamic_pointer_cast<Sphere>(list.objects[0]);
+  LinearBVH refit_bvh(list, 0, 1, big_leaves);
+  sphere->radius = 0.25;
+  refit_bvh.refit();
+  const Ray r(sphere->center0 + Vec3(0, 0, 10), Vec3(0, 0, -1));
+  double t_list, t_bvh;
+  assert(list.hit_distance(r, 0.001, infinity, &t_list));
+  assert(refit_bvh.hit_distance(r, 0.001, infinity, &t_bvh) && t_bvh == t_list);
+}
+
+void test_transform()
+{
+  auto sphere = make_shared<Sphere>(Point3(0, 0, 0), 1, nullptr);
+
+  // Chains of Translate / RotateY / FlipFace fold into one transform of the original object
+  auto offset_sphere = make_shared<Sphere>(Point3(1, 2, 3), 0.5, nullptr);
+  const auto rotation = Affine3::rotation(Vec3(0, 1, 0), 30);
+  const Translate chain(make_shared<RotateY>(make_shared<FlipFace>(offset_sphere), 30), Vec3(-2, 1, 0));
+  assert(chain.ptr == offset_sphere);
+  assert(chain.flip_faces);
+  const Point3 moved_center = rotation.apply_point(Point3(1, 2, 3)) + Vec3(-2, 1, 0);
+  HittableList moved_sphere;
+  moved_sphere.add(make_shared<Sphere>(moved_center, 0.5, nullptr));
+  expect_same_hits(chain, moved_sphere, 2000);
+
+  hit_record flipped_rec;
+  assert(chain.hit(Ray(Point3(0, 0, 0), moved_center), 0.001, infinity, &flipped_rec));
+  assert(!flipped_rec.front_face); // hit from outside, but faces are flipped
+
+  // Scaled and moved unit sphere behaves like a bigger sphere, including for importance sampling
+  const Transform scaled(sphere, Affine3::translation(Vec3(2, 5, 10)) * Affine3::scaling(3) * rotation);
+  HittableList big_sphere;
+  big_sphere.add(make_shared<Sphere>(Point3(2, 5, 10), 3, nullptr));
+  expect_same_hits(scaled, big_sphere, 2000);
+
+  const Point3 origin(10, 5, -20);
+  const Vec3 v = scaled.random(origin);
+  EXPECT_NEAR(scaled.pdf_value(origin, v), big_sphere.pdf_value(origin, v), 1e-9);
+
+  hit_record rec;
+  assert(scaled.hit(Ray(Point3(2, 5, 0), Vec3(0, 0, 1)), 0.001, infinity, &rec));
+  EXPECT_NEAR((rec.normal - Vec3(0, 0, -1)).length(), 0, 1e-9);
+
+  // Instances sharing one BVH, in a BVH of their own
+  auto spheres_bvh = make_shared<LinearBVH>(random_spheres(100), 0, 1);
+  HittableList instances;
+  for (int i = 0; i < 50; ++i)
+    instances.add(make_shared<Transform>(spheres_bvh, Affine3::translation(Vec3::random(-50, 50)) *
+                                                          Affine3::rotation(random_unit_vector(), random_double(0, 360)) *
+                                                          Affine3::scaling(Vec3::random(0.5, 2))));
+  expect_same_hits(LinearBVH(instances, 0, 1), instances, 2000);
+}
+
+void test_mesh_cache()
+{
+  const std::string mesh_file = "examples/meshes/teapot.obj";
+
+  // Off by default: nothing is written
+  mesh_cache::directory = "";
+  const auto built = import_triangle_mesh(mesh_file, nullptr);
+  mesh_cache::directory = "/tmp/bubbles_test_mesh_cache";
+  const std::string cache_file = mesh_cache::cache_file(mesh_file);
+  assert(cache_file.rfind("/tmp/bubbles_test_mesh_cache/teapot.obj.", 0) == 0);
+  std::remove(cache_file.c_str());
+
+  import_triangle_mesh(mesh_file, nullptr);
+  assert(std::ifstream(cache_file));
+  const auto cached = import_triangle_mesh(mesh_file, nullptr);
+  assert(cached->num_nodes == built->num_nodes);
+  assert(cached->num_triangles == built->num_triangles);
+  expect_same_hits(*cached, *built, 2000);
+
+  // Different build options don't match the cache
+  BVHBuildOptions other_opts;
+  other_opts.max_leaf_size = 1;
+  assert(import_triangle_mesh(mesh_file, nullptr, other_opts)->num_nodes > built->num_nodes);
+
+  // Corrupt contents are rejected: an index past the vertices, a child outside the tree, a leaf past the
+  // triangles, or a section that doesn't fit in the file
+  import_triangle_mesh(mesh_file, nullptr);
+  mesh_cache::Header header;
+  std::ifstream(cache_file, std::ios::binary).read(reinterpret_cast<char *>(&header), sizeof(header));
+  auto expect_rejected = [&](uint64_t position, const void *data, size_t bytes)
+  {
+    import_triangle_mesh(mesh_file, nullptr); // fresh cache
+    {
+      std::fstream file(cache_file, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(position);
+      file.write(static_cast<const char *>(data), bytes);
+    }
+    mesh_cache::View view;
+    assert(!mesh_cache::load(cache_file, mesh_file, BVHBuildOptions(), &view));
+  };
+  const uint32_t bad_index = static_cast<uint32_t>(header.num_vertices);
+  expect_rejected(header.indices_offset + 4, &bad_index, sizeof(bad_index));
+  const int32_t bad_child = static_cast<int32_t>(header.num_nodes);
+  expect_rejected(header.nodes_offset + offsetof(LinearBVHNode, offset), &bad_child, sizeof(bad_child));
+  const int32_t root_as_child = 0;
+  expect_rejected(header.nodes_offset + offsetof(LinearBVHNode, offset), &root_as_child, sizeof(root_as_child));
+  for (uint64_t i = 0; i < header.num_nodes; ++i)
+  {
+    LinearBVHNode node;
+    std::ifstream in(cache_file, std::ios::binary);
+    in.seekg(header.nodes_offset + i * sizeof(LinearBVHNode));
+    in.read(reinterpret_cast<char *>(&node), sizeof(node));
+    if (node.num_primitives > 0)
+    {
+      const uint32_t too_many = static_cast<uint32_t>(header.num_triangles) + 1;
+      expect_rejected(header.nodes_offset + i * sizeof(LinearBVHNode) + offsetof(LinearBVHNode, num_primitives),
+                      &too_many, sizeof(too_many));
+      break;
+    }
+  }
+  const uint64_t huge_count = uint64_t(1) << 62; // overflows when multiplied by the element size
+  expect_rejected(offsetof(mesh_cache::Header, num_vertices), &huge_count, sizeof(huge_count));
+  expect_rejected(offsetof(mesh_cache::Header, num_nodes), &huge_count, sizeof(huge_count));
+
+  // and rebuilt
+  expect_same_hits(*import_triangle_mesh(mesh_file, nullptr), *built, 2000);
+
+  std::remove(cache_file.c_str());
+  mesh_cache::directory = "";
+}
+
+void test_triangle_mesh()
+{
+  // Same hits as individual triangles
+  const std::string mesh_file = "examples/meshes/teapot.obj";
+  const TriangleMesh mesh(load_mesh_data(mesh_file), nullptr);
+  const HittableList triangles = load_triangles(mesh_file, nullptr);
+  assert(mesh.num_triangles == triangles.objects.size());
+  expect_same_hits(mesh, triangles, 2000);
+
+  // Leaves with more triangles than fit in one pack
+  BVHBuildOptions big_leaf_opts;
+  big_leaf_opts.max_leaf_size = 7;
+  expect_same_hits(TriangleMesh(load_mesh_data(mesh_file), nullptr, big_leaf_opts), triangles, 2000);
+
+  // Also when the BVH is built on several threads
+  BVHBuildOptions parallel_opts;
+  parallel_opts.num_threads = 4;
+  MeshData big_mesh;
+  for (uint32_t tri = 0; tri < 10000; ++tri)
+  {
+    const Point3 center = Vec3::random(-10, 10);
+    for (int k = 0; k < 3; ++k)
+    {
+      const Point3 p = center + Vec3::random(-0.5, 0.5);
+      big_mesh.vertices.insert(big_mesh.vertices.end(), {float(p.x()), float(p.y()), float(p.z())});
+      big_mesh.indices.push_back(3 * tri + k);
+    }
+  }
+  HittableList big_triangles;
+  big_triangles.objects = make_triangles(big_mesh.vertices.data(), big_mesh.indices.data(), 10000, nullptr);
+  const TriangleMesh big(big_mesh, nullptr, parallel_opts);
+  expect_same_hits(big, big_triangles, 2000);
+
+  hit_record rec;
+  assert(mesh.hit(Ray(Point3(0, 1, 10), Vec3(0, 0, -1)), 0.001, infinity, &rec));
+  EXPECT_NEAR(rec.normal.length(), 1, 1e-9);
 }
 
 void test_obj_loader()
@@ -143,6 +746,18 @@ int main()
   test_translate_importance_sampling();
   test_rotate_importance_sampling();
   test_triangle();
+  test_single_precision();
+  test_bvh();
+  test_bvh_refit();
+  test_deep_bvh();
+  test_particle_cloud();
+  test_bvh_motion();
+  test_box();
+  test_deferred_hit();
+  test_typed_leaves();
+  test_transform();
+  test_triangle_mesh();
+  test_mesh_cache();
   test_obj_loader();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "render.h"
+#include "scenes.h"
+#include "tile_scheduler.h"
+#include "wavefront.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
+#include "external/tinyobjloader.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+void test_tiles_cover_image()
+{
+  const int H = 37;
+  const int W = 53;
+
+  for (auto order : {TileOrder::Scanline, TileOrder::Morton, TileOrder::Spiral})
+  {
+    // Every pixel should be handed out exactly once, no matter how many workers steal from each other
+    const auto tiles = make_tiles(H, W, 8, order);
+    TileScheduler scheduler(tiles, 3);
+
+    std::vector<int> pixel_counts(H * W, 0);
+    Tile tile;
+    int worker = 0;
+    while (scheduler.next(worker, &tile))
+    {
+      for (int row = tile.row0; row < tile.row1; ++row)
+        for (int col = tile.col0; col < tile.col1; ++col)
+          pixel_counts[row * W + col]++;
+      worker = (worker + 2) % 3; // uneven pulling, so that some queues get stolen from
+    }
+
+    for (int c : pixel_counts)
+      assert(c == 1);
+  }
+}
+
+void test_spiral_starts_at_center()
+{
+  const auto tiles = make_tiles(64, 64, 16, TileOrder::Spiral);
+  assert(tiles.size() == 16);
+
+  // First ring is the 2x2 block of tiles around the image center
+  for (int i = 0; i < 4; ++i)
+  {
+    assert(tiles[i].row0 >= 16 && tiles[i].row1 <= 48);
+    assert(tiles[i].col0 >= 16 && tiles[i].col1 <= 48);
+  }
+}
+
+std::string render_to_string(const Scene &scene, const Hittable &world, const RenderOptions &opts)
+{
+  std::ostringstream out;
+  render(out, world, scene.lights, *scene.cam, 24, 24, scene.background, /*spp*/ 4, /*max_depth*/ 10, opts);
+  return out.str();
+}
+
+void test_render_independent_of_thread_count()
+{
+  Scene scene = cornell_box();
+  auto world = LinearBVH(scene.objects, 0, 1);
+
+  RenderOptions opts;
+  opts.print_progress = false;
+  opts.tile_size = 5;
+
+  opts.num_threads = 1;
+  const auto single_threaded = render_to_string(scene, world, opts);
+
+  opts.num_threads = 3;
+  opts.tile_order = TileOrder::Morton;
+  const auto multi_threaded = render_to_string(scene, world, opts);
+
+  assert(single_threaded == multi_threaded);
+}
+
+void test_wavefront_matches_render()
+{
+  for (const auto &scene : {cornell_box(), cornell_box_hard()})
+  {
+    for (const auto integrator : {Integrator::Mixture, Integrator::NextEventEstimation})
+    {
+      auto world = LinearBVH(scene.objects, 0, 1);
+
+      RenderOptions opts;
+      opts.print_progress = false;
+      opts.num_threads = 2;
+      opts.wavefront_batch_size = 1000; // force several batches, with pixels split across batches
+      opts.integrator = integrator;
+
+      std::ostringstream depth_first, wavefront;
+      render(depth_first, world, scene.lights, *scene.cam, 24, 24, scene.background, 4, 10, opts);
+      render_wavefront(wavefront, world, scene.lights, *scene.cam, 24, 24, scene.background, 4, 10, opts);
+
+      assert(depth_first.str() == wavefront.str());
+    }
+  }
+}
+
+void test_next_event_estimation_unbiased()
+{
+  // Both integrators estimate the same radiance; compare their means over many paths
+  for (const auto &scene : {cornell_box(), cornell_box_hard()})
+  {
+    const LinearBVH world(scene.objects, 0, 1);
+    const int num_paths = 100000;
+    Color mixture(0, 0, 0), next_event(0, 0, 0);
+    for (int i = 0; i < num_paths; ++i)
+    {
+      rng::start_path(i, 0);
+      const Ray r = scene.cam->get_ray(random_double(), random_double());
+      mixture += ray_color(r, scene.background, world, scene.lights.get(), 50, Integrator::Mixture);
+      rng::start_path(i, 1);
+      next_event += ray_color(r, scene.background, world, scene.lights.get(), 50, Integrator::NextEventEstimation);
+    }
+    for (int c = 0; c < 3; ++c)
+      assert(std::abs(next_event[c] / mixture[c] - 1) < 0.05);
+  }
+}
+
+void test_material_dispatch()
+{
+  // Flattened texture graph evaluates the same as the texture tree it was compiled from
+  auto inner = make_shared<CheckerTexture>(Color(1, 0, 0), Color(0, 1, 0));
+  auto checker = make_shared<CheckerTexture>(inner, make_shared<SolidColor>(0.2, 0.3, 0.4));
+  const TextureGraph graph(checker);
+  assert(graph.nodes.size() == 5);
+  for (int i = 0; i < 1000; ++i)
+  {
+    const Point3 p = Vec3::random(-5, 5);
+    assert((graph.value(0.5, 0.5, p) - checker->value(0.5, 0.5, p)).length_squared() == 0);
+  }
+
+  // Switch dispatch scatters exactly like the virtual call, including for materials it doesn't know
+  class Absorbing : public Material
+  {
+  };
+  const shared_ptr<Material> materials[] = {
+      make_shared<Lambertian>(checker), make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.3),
+      make_shared<Dielectric>(1.5), make_shared<DiffuseLight>(Color(4, 4, 4)),
+      make_shared<Isotropic>(Color(0.5, 0.5, 0.5)), make_shared<Absorbing>()};
+  for (const auto &m : materials)
+  {
+    hit_record rec;
+    rec.p = Point3(0.3, 0.2, 0.1);
+    rec.normal = Vec3(0, 1, 0);
+    rec.front_face = true;
+    rec.u = rec.v = 0.5;
+    const Ray r(Point3(0, 1, 0), Vec3(0.3, -0.8, 0.1));
+
+    scatter_record virtual_srec, visited_srec;
+    rng::start_path(0, 0);
+    const bool virtual_scattered = m->scatter(r, rec, &virtual_srec);
+    rng::start_path(0, 0);
+    const bool visited_scattered = material::visit(*m, [&](const auto &concrete)
+                                                   { return concrete.scatter(r, rec, &visited_srec); });
+    assert(visited_scattered == virtual_scattered);
+    if (virtual_scattered)
+    {
+      assert((visited_srec.attenuation - virtual_srec.attenuation).length_squared() == 0);
+      assert(visited_srec.is_specular == virtual_srec.is_specular);
+      if (virtual_srec.is_specular)
+        assert((visited_srec.specular_ray.direction() - virtual_srec.specular_ray.direction()).length_squared() == 0);
+    }
+
+    const Color emitted = material::visit(*m, [&](const auto &concrete)
+                                          { return concrete.emitted(r, rec, rec.u, rec.v, rec.p); });
+    assert((emitted - m->emitted(r, rec, rec.u, rec.v, rec.p)).length_squared() == 0);
+  }
+}
+
+int main()
+{
+  test_tiles_cover_image();
+  test_spiral_starts_at_center();
+  test_render_independent_of_thread_count();
+  test_wavefront_matches_render();
+  test_next_event_estimation_unbiased();
+  test_material_dispatch();
+  return 0;
+}